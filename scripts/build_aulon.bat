@@ -8,7 +8,7 @@ echo Building aulon for Windows XP (32-bit)...
 echo ============================================
 echo.
 
-cl /Fe:aulon.exe /MT /D_USING_V110_SDK71_ /I "D:\AntigravityProjects\iQueGithub\libusb\include" /I "D:\AntigravityProjects\iQueGithub\libusb\include\libusb-1.0" src\main.c src\commands.c src\fs.c src\io.c src\menu.c src\menu_func.c src\player_comms.c src\usb.c src\usb_log.c src\server.c /link /SUBSYSTEM:CONSOLE,5.01 "D:\AntigravityProjects\iQueGithub\libusb\VS2013\MS32\dll\libusb-1.0.lib" Advapi32.lib Ws2_32.lib /FORCE:MULTIPLE
+cl /Fe:aulon.exe /MT /D_USING_V110_SDK71_ /I "D:\AntigravityProjects\iQueGithub\libusb\include" /I "D:\AntigravityProjects\iQueGithub\libusb\include\libusb-1.0" src\main.c src\commands.c src\fs.c src\io.c src\menu.c src\menu_func.c src\player_comms.c src\usb.c src\usb_log.c src\server.c src\fs_cache.c src\fs_alloc.c src\fs_index.c src\retry.c src\sparse.c src\nand_manifest.c src\dump_journal.c src\console_model.c src\usb_stats.c src\timing.c src\pool.c src\framing.c /link /SUBSYSTEM:CONSOLE,5.01 "D:\AntigravityProjects\iQueGithub\libusb\VS2013\MS32\dll\libusb-1.0.lib" Advapi32.lib Ws2_32.lib /FORCE:MULTIPLE
 
 echo.
 echo Copying MinGW XP-compatible libusb-1.0.dll...
@@ -43,7 +43,7 @@ echo ==============================================
 
 cd /d D:\AntigravityProjects\iQueGithub\aulon
 
-cl /Fe:aulon_fixed.exe /MT /DLIBUSB_STATIC /D_USING_V110_SDK71_ /I "%LIBUSB_DIR%\libusb" src\main.c src\commands.c src\fs.c src\io.c src\menu.c src\menu_func.c src\player_comms.c src\usb.c src\usb_log.c src\server.c /link /SUBSYSTEM:CONSOLE,5.01 libusb_xp.lib Advapi32.lib Ws2_32.lib setupapi.lib /FORCE:MULTIPLE
+cl /Fe:aulon_fixed.exe /MT /DLIBUSB_STATIC /D_USING_V110_SDK71_ /I "%LIBUSB_DIR%\libusb" src\main.c src\commands.c src\fs.c src\io.c src\menu.c src\menu_func.c src\player_comms.c src\usb.c src\usb_log.c src\server.c src\fs_cache.c src\fs_alloc.c src\fs_index.c src\retry.c src\sparse.c src\nand_manifest.c src\dump_journal.c src\console_model.c src\usb_stats.c src\timing.c src\pool.c src\framing.c /link /SUBSYSTEM:CONSOLE,5.01 libusb_xp.lib Advapi32.lib Ws2_32.lib setupapi.lib /FORCE:MULTIPLE
 
 echo.
 if exist aulon_fixed.exe echo SUCCESS: aulon_fixed.exe built!
@@ -68,7 +68,7 @@ if errorlevel 1 (
 )
 
 echo Compiling C sources...
-cl %OPTS% %INCLUDES% src\commands.c src\fs.c src\aulon_io.c src\menu_func.c src\player_comms.c src\usb.c src\usb_log.c %LIBUSB_FILES% gui/resource.res gui\main_gui.obj /Fe:dist\ique_home.exe /link %LIBS% /SUBSYSTEM:WINDOWS,5.01
+cl %OPTS% %INCLUDES% src\commands.c src\fs.c src\aulon_io.c src\menu_func.c src\player_comms.c src\usb.c src\usb_log.c src\fs_cache.c src\fs_alloc.c src\fs_index.c src\retry.c src\sparse.c src\nand_manifest.c src\dump_journal.c src\console_model.c src\usb_stats.c src\timing.c src\pool.c src\framing.c %LIBUSB_FILES% gui/resource.res gui\main_gui.obj /Fe:dist\ique_home.exe /link %LIBS% /SUBSYSTEM:WINDOWS,5.01
 
 if errorlevel 1 (
    echo BUILD FAILED
@@ -84,7 +84,7 @@ if errorlevel 1 (
 )
 
 echo Linking Modern GUI...
-cl %OPTS% %INCLUDES% src\commands.c src\fs.c src\aulon_io.c src\menu_func.c src\player_comms.c src\usb.c src\usb_log.c %LIBUSB_FILES% gui/resource.res gui\modern_gui.obj /Fe:dist\ique_modern.exe /link %LIBS% /SUBSYSTEM:WINDOWS,5.01
+cl %OPTS% %INCLUDES% src\commands.c src\fs.c src\aulon_io.c src\menu_func.c src\player_comms.c src\usb.c src\usb_log.c src\fs_cache.c src\fs_alloc.c src\fs_index.c src\retry.c src\sparse.c src\nand_manifest.c src\dump_journal.c src\console_model.c src\usb_stats.c src\timing.c src\pool.c src\framing.c %LIBUSB_FILES% gui/resource.res gui\modern_gui.obj /Fe:dist\ique_modern.exe /link %LIBS% /SUBSYSTEM:WINDOWS,5.01
 
 if errorlevel 1 (
    echo BUILD FAILED
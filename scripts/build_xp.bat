@@ -50,6 +50,18 @@ cl %OPTS% %INCLUDES% ^
   src\usb.c ^
   src\usb_log.c ^
   src\server.c ^
+  src\fs_cache.c ^
+  src\fs_alloc.c ^
+  src\fs_index.c ^
+  src\retry.c ^
+  src\sparse.c ^
+  src\nand_manifest.c ^
+  src\dump_journal.c ^
+  src\console_model.c ^
+  src\usb_stats.c ^
+  src\timing.c ^
+  src\pool.c ^
+  src\framing.c ^
   %LIBUSB_SRC%\core.c ^
   %LIBUSB_SRC%\descriptor.c ^
   %LIBUSB_SRC%\hotplug.c ^
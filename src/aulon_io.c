@@ -135,6 +135,14 @@ uint32_t uchars_to_uint32(unsigned char *bytes) {
   return out;
 }
 
+// Assumes 8-bit char; writes an array of 4 bytes
+void uint32_to_uchars(unsigned char *bytes, uint32_t value) {
+  bytes[0] = (unsigned char)(value >> 24);
+  bytes[1] = (unsigned char)(value >> 16);
+  bytes[2] = (unsigned char)(value >> 8);
+  bytes[3] = (unsigned char)value;
+}
+
 // Assumes 8-bit char and array of 4 bytes as input
 int32_t uchars_to_int32(unsigned char *bytes) {
   int32_t out = 0;
@@ -156,3 +164,11 @@ int16_t uchars_to_int16(unsigned char *bytes) {
   }
   return out;
 }
+
+uint64_t fnv1a_64(const unsigned char *data, size_t length, uint64_t hash) {
+  size_t i;
+  for (i = 0; i < length; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
@@ -25,18 +25,28 @@
 
 #include "commands.h"
 #include "io.h"
+#include "nand_manifest.h"
 
 #ifdef GUI_BUILD
 #include "gui_redirect.h"
 #endif
 #include "player_comms.h"
+#include "pool.h"
+#include "retry.h"
+#include "usb.h"
 
 static int command_error(unsigned char *buffer);
+static int retry_block_command(unsigned int attempt);
+static int recover_after_error(void);
 
+static int read_block(uint32_t command, unsigned char *block_buffer,
+                      unsigned char *spare_buffer, uint32_t block_number);
 static int request_block_read(uint32_t command, uint32_t block_number);
 static int get_block(unsigned char *block_buffer);
 static int get_spare(unsigned char *spare_buffer);
 
+static int write_block(uint32_t command, unsigned char *block_buffer,
+                       unsigned char *spare_buffer, uint32_t block_number);
 static int request_block_write(uint32_t command, uint32_t block_number);
 static int check_block_write(uint32_t block_number);
 static int send_block(unsigned char *block_buffer);
@@ -45,12 +55,55 @@ static int send_spare(unsigned char *spare_buffer);
 static int send_filename(const char *filename);
 static int send_params_and_receive_reply(uint32_t checksum, uint32_t size);
 
+// Set when the console rejects a command, to tell rejections apart from
+// transfer errors when deciding on a retry.
+static int command_rejected = 0;
+
 /*
     Some commands return negative error codes in the second word
     of the command response to indicate an error occured.
 */
 static int command_error(unsigned char *buffer) {
-  return uchars_to_int32(&buffer[4]) < 0;
+  command_rejected = uchars_to_int32(&buffer[4]) < 0;
+  return command_rejected;
+}
+
+/*
+    Decide, according to the retry policy, whether a block command that
+    failed on attempt number [attempt] is tried again. Returns 1 once the
+    backoff has passed and the connection is usable again.
+*/
+static int retry_block_command(unsigned int attempt) {
+  enum retry_error_class error = RETRY_ERROR_TRANSFER;
+  if (usb_connection_failed()) {
+    error = RETRY_ERROR_CONNECTION;
+  } else if (command_rejected) {
+    error = RETRY_ERROR_REJECTED;
+  }
+  return retry_after_failure(attempt, error) && recover_after_error();
+}
+
+/*
+    After an error that broke the connection, the connection is reset and
+    the console is set up again like Init does, so that the block operation
+    can be retried from its start. Returns 0 if it should not be retried.
+*/
+static int recover_after_error(void) {
+  if (!usb_connection_failed()) {
+    return 1;
+  }
+  if (!usb_recover_connection()) {
+    fprintf(stderr, "The connection to the console could not be restored.\n");
+    return 0;
+  }
+  ique_reset_protocol();
+  if (!set_seqno(0x0001) || !init_fs()) {
+    fprintf(stderr, "The console could not be set up again after resetting "
+                    "the connection.\n");
+    return 0;
+  }
+  printf("Connection restored; retrying.\n");
+  return 1;
 }
 
 /*
@@ -60,47 +113,79 @@ static int command_error(unsigned char *buffer) {
     of the block's last page.
 */
 int read_block_only(unsigned char *block_buffer, uint32_t block_number) {
-  unsigned attempts = 1;
-  int success = 0;
-  while (attempts <= 5) {
-    attempts++;
-    if (!request_block_read(READ_BLOCK_ONLY, block_number)) {
-      success = 0;
-    } else if (!get_block(block_buffer)) {
-      fprintf(stderr, "Reading block 0x%04x failed.\n", block_number);
-      success = 0;
-    } else {
-      success = 1;
-      break;
-    }
-  }
+  return read_block(READ_BLOCK_ONLY, block_buffer, NULL, block_number);
+}
+
+int read_block_spare(unsigned char *block_buffer, unsigned char *spare_buffer,
+                     uint32_t block_number) {
+  return read_block(READ_BLOCK_AND_SPARE, block_buffer, spare_buffer,
+                    block_number);
+}
+
+/*
+    Read a run of consecutive blocks, handing each one to the callback as
+    soon as it has been received. The buffers are set up once for the whole
+    run, and the replies are decoded straight into them. Without with_spare
+    the blocks are read with READ_BLOCK_ONLY, which saves the spare reply,
+    and the callback gets NULL for the spare. Stops at the first block that
+    cannot be read or that the callback rejects.
+*/
+int read_blocks(uint32_t first_block, uint32_t count, int with_spare,
+                block_read_callback callback, void *context) {
+  unsigned char *block_buffer = pool_acquire(BLOCK_SIZE);
+  unsigned char *spare_buffer = with_spare ? pool_acquire(SPARE_SIZE) : NULL;
+  int success = (block_buffer != NULL && (!with_spare || spare_buffer != NULL));
   if (!success) {
-    fprintf(stderr, "Reading block unsuccessful after 5 retries!\n");
+    fprintf(stderr, "Could not allocate memory for reading blocks!\n");
+  }
+
+  uint32_t command = with_spare ? READ_BLOCK_AND_SPARE : READ_BLOCK_ONLY;
+  for (uint32_t block_number = first_block;
+       success && block_number < first_block + count; ++block_number) {
+    success =
+        read_block(command, block_buffer, spare_buffer, block_number) &&
+        callback(block_number, block_buffer, spare_buffer, context);
   }
+
+  pool_release(block_buffer);
+  pool_release(spare_buffer);
   return success;
 }
 
-int read_block_spare(unsigned char *block_buffer, unsigned char *spare_buffer,
-                     uint32_t block_number) {
-  unsigned attempts = 1;
+int read_blocks_spare(uint32_t first_block, uint32_t count,
+                      block_read_callback callback, void *context) {
+  return read_blocks(first_block, count, 1, callback, context);
+}
+
+/*
+    The spare is only read (and the block only recorded in the manifest)
+    when spare_buffer is not NULL.
+*/
+static int read_block(uint32_t command, unsigned char *block_buffer,
+                      unsigned char *spare_buffer, uint32_t block_number) {
+  unsigned int attempt = 0;
   int success = 0;
-  while (attempts <= 5) {
-    attempts++;
-    if (!request_block_read(READ_BLOCK_AND_SPARE, block_number)) {
+  do {
+    ++attempt;
+    command_rejected = 0;
+    if (!request_block_read(command, block_number)) {
       success = 0;
     } else if (!get_block(block_buffer)) {
       fprintf(stderr, "Reading block 0x%04x failed.\n", block_number);
       success = 0;
-    } else if (!get_spare(spare_buffer)) {
+    } else if (spare_buffer != NULL && !get_spare(spare_buffer)) {
       fprintf(stderr, "Reading block 0x%04x spare failed.\n", block_number);
       success = 0;
     } else {
       success = 1;
       break;
     }
-  }
+  } while (retry_block_command(attempt));
   if (!success) {
-    fprintf(stderr, "Reading block unsuccessful after 5 retries!\n");
+    fprintf(stderr, "Reading block unsuccessful after %u attempts!\n",
+            attempt);
+  } else if (spare_buffer != NULL) {
+    nand_manifest_set(block_number, block_buffer, spare_buffer);
   }
   return success;
 }
@@ -133,14 +218,10 @@ static int request_block_read(uint32_t command, uint32_t block_number) {
 }
 
 static int get_block(unsigned char *block_buffer) {
-  unsigned char chunk_buffer[BLOCK_CHUNK_SIZE] = {0};
   unsigned int i;
-  unsigned int offset = 0;
   for (i = 0; i < CHUNKS_PER_BLOCK; ++i) {
-    if (ique_receive_reply(chunk_buffer, BLOCK_CHUNK_SIZE)) {
-      memcpy(block_buffer + offset, chunk_buffer, BLOCK_CHUNK_SIZE);
-      offset += BLOCK_CHUNK_SIZE;
-    } else {
+    if (!ique_receive_reply(block_buffer + i * BLOCK_CHUNK_SIZE,
+                            BLOCK_CHUNK_SIZE)) {
       return 0;
     }
   }
@@ -159,25 +240,9 @@ static int get_spare(unsigned char *spare_buffer) {
     of the block's last page.
 */
 int write_block_only(unsigned char *block_buffer, uint32_t block_number) {
-  unsigned int attempts = 1;
-  int success = 0;
-  while (attempts <= 5) {
-    attempts++;
-    if (!request_block_write(WRITE_BLOCK_ONLY, block_number)) {
-      success = 0;
-    } else if (!send_block(block_buffer)) {
-      fprintf(stderr, "Writing block 0x%04x failed.\n", block_number);
-      success = 0;
-    } else if (!check_block_write(block_number)) {
-      success = 0;
-    } else {
-      success = 1;
-      break;
-    }
-  }
-  if (!success) {
-    fprintf(stderr, "Writing block unsuccessful after 5 retries!\n");
-  }
+  int success = write_block(WRITE_BLOCK_ONLY, block_buffer, NULL, block_number);
+  // The spare is not rewritten, so the block's hash is no longer known.
+  nand_manifest_forget(block_number);
   return success;
 }
 
@@ -188,16 +253,32 @@ int write_block_spare(unsigned char *block_buffer, unsigned char *spare_buffer,
     return 1;
   }
 
-  unsigned attempts = 1;
+  int success = write_block(WRITE_BLOCK_AND_SPARE, block_buffer, spare_buffer,
+                            block_number);
+  if (!success) {
+    nand_manifest_forget(block_number);
+  } else {
+    nand_manifest_set(block_number, block_buffer, spare_buffer);
+  }
+  return success;
+}
+
+/*
+    The spare is only sent when spare_buffer is not NULL.
+*/
+static int write_block(uint32_t command, unsigned char *block_buffer,
+                       unsigned char *spare_buffer, uint32_t block_number) {
+  unsigned int attempt = 0;
   int success = 0;
-  while (attempts <= 5) {
-    attempts++;
-    if (!request_block_write(WRITE_BLOCK_AND_SPARE, block_number)) {
+  do {
+    ++attempt;
+    command_rejected = 0;
+    if (!request_block_write(command, block_number)) {
       success = 0;
     } else if (!send_block(block_buffer)) {
       fprintf(stderr, "Writing block 0x%04x failed.\n", block_number);
       success = 0;
-    } else if (!send_spare(spare_buffer)) {
+    } else if (spare_buffer != NULL && !send_spare(spare_buffer)) {
       fprintf(stderr, "Writing block 0x%04x spare failed.\n", block_number);
       success = 0;
     } else if (!check_block_write(block_number)) {
@@ -206,9 +287,10 @@ int write_block_spare(unsigned char *block_buffer, unsigned char *spare_buffer,
       success = 1;
       break;
     }
-  }
+  } while (retry_block_command(attempt));
   if (!success) {
-    fprintf(stderr, "Writing block unsuccessful after 5 retries!\n");
+    fprintf(stderr, "Writing block unsuccessful after %u attempts!\n",
+            attempt);
   }
   return success;
 }
@@ -221,8 +303,7 @@ static int request_block_write(uint32_t command, uint32_t block_number) {
             block_number);
     return 0;
   }
-  ique_wait_for_ready();
-  return 1;
+  return ique_wait_for_ready();
 }
 
 static int check_block_write(uint32_t block_number) {
@@ -248,13 +329,16 @@ static int send_block(unsigned char *block_buffer) {
 }
 
 static int send_spare(unsigned char *spare_buffer) {
-  ique_wait_for_ready();
+  if (!ique_wait_for_ready()) {
+    return 0;
+  }
   // Other than the SA data (first 3 bytes), rest can all be 0xFF.
   unsigned int i;
   for (i = 3; i < SPARE_SIZE; ++i) {
     spare_buffer[i] = 0xFF;
   }
-  return ique_send_piecemeal_data(spare_buffer, SPARE_SIZE);
+  unsigned char frame[FRAMING_PIECEMEAL_LENGTH(SPARE_SIZE)];
+  return ique_send_piecemeal_buffer(spare_buffer, SPARE_SIZE, frame);
 }
 
 /*
@@ -386,24 +470,19 @@ static int send_filename(const char *filename) {
                     "the console.\n");
     return 0;
   }
-  ique_wait_for_ready();
-
-  unsigned char *fn_data = calloc(fn_len, sizeof(unsigned char));
-  if (fn_data == NULL) {
-    fprintf(stderr, "Could not allocate memory for filename data.\n");
+  if (!ique_wait_for_ready()) {
     return 0;
   }
 
+  unsigned char fn_data[13] = {0};
+  unsigned char frame[FRAMING_PIECEMEAL_LENGTH(13)];
   memcpy(fn_data, filename, fn_len - 1);
 
-  if (!ique_send_piecemeal_data(fn_data, fn_len)) {
+  if (!ique_send_piecemeal_buffer(fn_data, fn_len, frame)) {
     fprintf(stderr, "Error sending filename to the console.\n");
-    free(fn_data);
     return 0;
   }
-  free(fn_data);
-  ique_wait_for_ready();
-  return 1;
+  return ique_wait_for_ready();
 }
 
 static int send_params_and_receive_reply(uint32_t checksum, uint32_t size) {
@@ -519,8 +598,11 @@ int sign_hash(unsigned char *hash_in, unsigned char *sig_out) {
     return 0;
   }
 
-  ique_wait_for_ready();
-  ique_send_chunked_data(hash_in, SHA1_HASH_LENGTH);
+  if (!ique_wait_for_ready() ||
+      !ique_send_chunked_data(hash_in, SHA1_HASH_LENGTH)) {
+    fprintf(stderr, "Error sending hash to the console.\n");
+    return 0;
+  }
 
   unsigned char reply_buffer[8] = {0};
   if (!ique_receive_reply(reply_buffer, 8)) {
@@ -57,6 +57,17 @@ int write_block_only(unsigned char * block_buffer, uint32_t block_number);
 int read_block_only(unsigned char * block_buffer, uint32_t block_number);
 int write_block_spare(unsigned char * block_buffer, unsigned char * spare_buffer, uint32_t block_number);
 int read_block_spare(unsigned char * block_buffer, unsigned char * spare_buffer, uint32_t block_number);
+
+// Called by read_blocks with each block read; spare_buffer is NULL unless the
+// spares are read. Returns 0 to stop reading.
+typedef int (*block_read_callback)(uint32_t block_number, unsigned char * block_buffer,
+                                   unsigned char * spare_buffer, void * context);
+// Reads the spares only if with_spare is set; read_blocks_spare always does.
+int read_blocks(uint32_t first_block, uint32_t count, int with_spare,
+                block_read_callback callback, void * context);
+int read_blocks_spare(uint32_t first_block, uint32_t count, block_read_callback callback,
+                      void * context);
+
 int init_fs(void);
 int get_num_blocks(void);
 int set_seqno(uint32_t arg);
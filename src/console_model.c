@@ -0,0 +1,624 @@
+/*
+    console_model.c
+    a software iQue Player backed by a NAND image, used as a USB transport
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "libusb.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "commands.h"
+#include "console_model.h"
+#include "fs.h"
+#include "io.h"
+
+#ifdef GUI_BUILD
+#include "gui_redirect.h"
+#endif
+
+/*
+    The model reacts to everything the host sends as soon as it arrives, so
+    it is always waiting for the host: an IN transfer with nothing queued
+    returns a ready signal (15 00 00 00). Everything else it sends is a
+    reply, queued as two messages like the player sends them: the length
+    header (1B + 3-byte length) and the framed data (1C+n units, 4 bytes
+    each). An IN transfer returns data from one message at most, like a
+    real transfer ending on a short packet.
+
+    Host data is decoded from piecemeal units (40+n), chunks (63, length)
+    and acknowledgements (44), and collected until the current step of the
+    command has all it needs.
+*/
+#define MODEL_OUT_SIZE 0x2000
+#define MODEL_MAX_MESSAGES 4
+#define FS_FIRST_BLOCK 0xFF0
+#define FS_BLOCK_COUNT 0x10
+#define SKSA_BLOCK_COUNT 0x40
+
+enum model_step {
+  AWAIT_COMMAND,
+  AWAIT_ACK,
+  AWAIT_BLOCK,
+  AWAIT_SPARE,
+  AWAIT_FILENAME,
+  AWAIT_CHECKSUM,
+  AWAIT_TIME,
+  AWAIT_HASH
+};
+
+// What to do once the host acknowledges a reply
+enum after_ack { ACK_IDLE, ACK_NEXT_CHUNK, ACK_TIME, ACK_SIGNATURE };
+
+static char *image_path = NULL;
+static FILE *nand_file = NULL;
+static FILE *spare_file = NULL;
+static unsigned char spares[NUM_BLOCKS][SPARE_SIZE];
+
+static enum model_step step = AWAIT_COMMAND;
+static enum after_ack after_ack = ACK_IDLE;
+static uint32_t command = 0;
+static uint32_t block_number = 0;
+static unsigned int next_chunk = 0;
+static int with_spare = 0;
+static unsigned char hash[SHA1_HASH_LENGTH];
+static char filename[13];
+
+// Host data
+static unsigned char input[BLOCK_SIZE + SPARE_SIZE];
+static size_t input_length = 0;
+static size_t input_needed = 8;
+static unsigned int unit_remaining = 0;
+static int expect_chunk_length = 0;
+
+// Messages for the host
+static unsigned char out_buffer[MODEL_OUT_SIZE];
+static size_t out_start = 0;
+static size_t out_end = 0;
+static size_t message_ends[MODEL_MAX_MESSAGES];
+static unsigned int message_count = 0;
+
+static int model_open(void);
+static int model_close(void);
+static int model_send(unsigned char *data, int length, int *actual_length,
+                      unsigned int timeout);
+static int model_receive(unsigned char *data, int length, int *actual_length,
+                         unsigned int timeout);
+
+static int open_images(void);
+static int create_blank_images(const char *spare_path);
+static void format_fs_block(unsigned char *block);
+static void reset_protocol(void);
+static void await(enum model_step next, size_t length);
+static int accept_byte(unsigned char byte);
+static int handle_input(void);
+static int handle_command(void);
+static int handle_ack(void);
+static int queue_message(const unsigned char *data, size_t length);
+static int queue_reply(const unsigned char *data, size_t length);
+static int queue_status(int32_t status);
+static int queue_chunk(void);
+static int read_nand(uint32_t block, size_t offset, unsigned char *buffer,
+                     size_t length);
+static int write_block(void);
+static int32_t check_file(const unsigned char *params);
+static int load_current_fs(unsigned char *fs);
+static size_t field_length(const unsigned char *field, size_t size);
+
+static const struct usb_transport model_transport = {
+    "console model", model_open, model_close, NULL, model_send, model_receive};
+
+void console_model_set_image(char *path) { image_path = path; }
+
+const struct usb_transport *console_model_transport(void) {
+  return &model_transport;
+}
+
+/*
+    Transport
+*/
+static int model_open(void) {
+  if (image_path == NULL) {
+    fprintf(stderr, "Console model: no NAND image was given.\n");
+    return 0;
+  }
+  if (!open_images()) {
+    model_close();
+    return 0;
+  }
+  reset_protocol();
+  printf("Console model: using NAND image %s.\n", image_path);
+  return 1;
+}
+
+static int model_close(void) {
+  if (nand_file) {
+    fclose(nand_file);
+    nand_file = NULL;
+  }
+  if (spare_file) {
+    fclose(spare_file);
+    spare_file = NULL;
+  }
+  return 1;
+}
+
+static int model_send(unsigned char *data, int length, int *actual_length,
+                      unsigned int timeout) {
+  (void)timeout;
+  *actual_length = 0;
+  for (int i = 0; i < length; ++i) {
+    unsigned char byte = data[i];
+    if (unit_remaining) {
+      --unit_remaining;
+      if (!accept_byte(byte)) {
+        return LIBUSB_ERROR_IO;
+      }
+    } else if (expect_chunk_length) {
+      expect_chunk_length = 0;
+      unit_remaining = byte;
+    } else if (byte >= 0x41 && byte <= 0x43) {
+      unit_remaining = byte - 0x40;
+    } else if (byte == 0x63) {
+      expect_chunk_length = 1;
+    } else if (byte == 0x44) {
+      if (!handle_ack()) {
+        return LIBUSB_ERROR_IO;
+      }
+    } else {
+      fprintf(stderr, "Console model: unexpected byte %02x from the host.\n",
+              byte);
+      return LIBUSB_ERROR_IO;
+    }
+    *actual_length = i + 1;
+  }
+  return 0;
+}
+
+static int model_receive(unsigned char *data, int length, int *actual_length,
+                         unsigned int timeout) {
+  static const unsigned char ready[4] = {0x15, 0, 0, 0};
+  (void)timeout;
+
+  if (message_count == 0) {
+    *actual_length = (length < 4) ? length : 4;
+    memcpy(data, ready, *actual_length);
+    return (length < 4) ? LIBUSB_ERROR_OVERFLOW : 0;
+  }
+
+  size_t available = message_ends[0] - out_start;
+  size_t count = ((size_t)length < available) ? (size_t)length : available;
+  memcpy(data, out_buffer + out_start, count);
+  out_start += count;
+  *actual_length = (int)count;
+
+  if (out_start == message_ends[0]) {
+    --message_count;
+    memmove(message_ends, message_ends + 1,
+            message_count * sizeof(message_ends[0]));
+    if (message_count == 0) {
+      out_start = 0;
+      out_end = 0;
+    }
+  }
+  return 0;
+}
+
+/*
+    NAND and spare images
+*/
+static int open_images(void) {
+  char spare_path[1024] = {0};
+  const char *base = strrchr(image_path, '/');
+  const char *base_win = strrchr(image_path, '\\');
+  if (base_win > base) {
+    base = base_win;
+  }
+  base = base ? base + 1 : image_path;
+  if (strlen(image_path) + 8 > sizeof(spare_path)) {
+    fprintf(stderr, "Console model: NAND image path is too long.\n");
+    return 0;
+  }
+  if (strncmp(base, "nand", 4) == 0) {
+    size_t prefix = (size_t)(base - image_path);
+    memcpy(spare_path, image_path, prefix);
+    strcat(spare_path, "spare");
+    strcat(spare_path, base + 4);
+  } else {
+    strcpy(spare_path, image_path);
+    strcat(spare_path, ".spare");
+  }
+
+  nand_file = fopen(image_path, "r+b");
+  if (nand_file == NULL) {
+    return create_blank_images(spare_path);
+  }
+  if (get_file_size(nand_file) != (size_t)BLOCK_SIZE * NUM_BLOCKS) {
+    fprintf(stderr, "Console model: %s is not the size of a NAND.\n",
+            image_path);
+    return 0;
+  }
+
+  spare_file = fopen(spare_path, "r+b");
+  if (spare_file == NULL) {
+    // Assume every block is good.
+    memset(spares, 0xFF, sizeof(spares));
+    if (!open_file(&spare_file, spare_path, "w+b")) {
+      return 0;
+    }
+    fwrite(spares, 1, sizeof(spares), spare_file);
+  } else if (fread(spares, 1, sizeof(spares), spare_file) != sizeof(spares)) {
+    fprintf(stderr, "Console model: could not read the spare image.\n");
+    return 0;
+  }
+  return 1;
+}
+
+static int create_blank_images(const char *spare_path) {
+  printf("Console model: creating a blank NAND image.\n");
+  if (!open_file(&nand_file, image_path, "w+b") ||
+      !open_file(&spare_file, spare_path, "w+b")) {
+    return 0;
+  }
+
+  static unsigned char block[BLOCK_SIZE];
+  for (uint32_t i = 0; i < NUM_BLOCKS; ++i) {
+    memset(block, 0xFF, BLOCK_SIZE);
+    if (i == NUM_BLOCKS - 1) {
+      format_fs_block(block);
+    } else if (i >= FS_FIRST_BLOCK) {
+      // Sequence number 0, so that the host does not take an erased block
+      // (whose sequence number reads as 0xFFFFFFFF) for the newest FS.
+      memset(block, 0, BLOCK_SIZE);
+    }
+    if (fwrite(block, 1, BLOCK_SIZE, nand_file) != BLOCK_SIZE) {
+      fprintf(stderr, "Console model: could not write the NAND image.\n");
+      return 0;
+    }
+  }
+
+  memset(spares, 0xFF, sizeof(spares));
+  fwrite(spares, 1, sizeof(spares), spare_file);
+  fflush(nand_file);
+  fflush(spare_file);
+  return 1;
+}
+
+/*
+    An empty filesystem: the SKSA and filesystem blocks are reserved, all
+    other blocks are free, and there are no files.
+*/
+static void format_fs_block(unsigned char *block) {
+  memset(block, 0, BLOCK_SIZE);
+  for (uint32_t i = 0; i < NUM_BLOCKS; ++i) {
+    if (i < SKSA_BLOCK_COUNT || i >= FS_FIRST_BLOCK) {
+      block[i * 2] = 0xFF;
+      block[i * 2 + 1] = 0xFD;
+    }
+  }
+  memcpy(&block[0x3FF4], "BBFS", 4);
+  uint32_to_uchars(&block[0x3FF8], 1);
+
+  // The 16-bit words of the block add up to 0xCAD7.
+  uint16_t sum = 0;
+  for (size_t i = 0; i < BLOCK_SIZE - 2; i += 2) {
+    sum = (uint16_t)(sum + ((block[i] << 8) | block[i + 1]));
+  }
+  uint16_t checksum = (uint16_t)(0xCAD7 - sum);
+  block[0x3FFE] = (unsigned char)(checksum >> 8);
+  block[0x3FFF] = (unsigned char)checksum;
+}
+
+static int read_nand(uint32_t block, size_t offset, unsigned char *buffer,
+                     size_t length) {
+  return fseek(nand_file, (long)block * BLOCK_SIZE + (long)offset,
+               SEEK_SET) == 0 &&
+         fread(buffer, 1, length, nand_file) == length;
+}
+
+static int write_block(void) {
+  if (fseek(nand_file, (long)block_number * BLOCK_SIZE, SEEK_SET) != 0 ||
+      fwrite(input, 1, BLOCK_SIZE, nand_file) != BLOCK_SIZE) {
+    return 0;
+  }
+  fflush(nand_file);
+  if (fseek(spare_file, (long)block_number * SPARE_SIZE, SEEK_SET) != 0 ||
+      fwrite(spares[block_number], 1, SPARE_SIZE, spare_file) != SPARE_SIZE) {
+    return 0;
+  }
+  fflush(spare_file);
+  return 1;
+}
+
+/*
+    Protocol
+*/
+static void reset_protocol(void) {
+  out_start = 0;
+  out_end = 0;
+  message_count = 0;
+  unit_remaining = 0;
+  expect_chunk_length = 0;
+  after_ack = ACK_IDLE;
+  await(AWAIT_COMMAND, 8);
+}
+
+static void await(enum model_step next, size_t length) {
+  step = next;
+  input_length = 0;
+  input_needed = length;
+}
+
+static int accept_byte(unsigned char byte) {
+  if (step == AWAIT_ACK || input_length >= input_needed) {
+    fprintf(stderr, "Console model: unexpected data from the host.\n");
+    return 0;
+  }
+  input[input_length++] = byte;
+  return (input_length < input_needed) ? 1 : handle_input();
+}
+
+static int handle_input(void) {
+  switch (step) {
+  case AWAIT_COMMAND:
+    return handle_command();
+  case AWAIT_BLOCK:
+    if (with_spare) {
+      // The spare follows the block in input[].
+      step = AWAIT_SPARE;
+      input_needed = BLOCK_SIZE + SPARE_SIZE;
+      return 1;
+    }
+    return queue_status(write_block() ? 0 : -1);
+  case AWAIT_SPARE:
+    memcpy(spares[block_number], input + BLOCK_SIZE, SPARE_SIZE);
+    return queue_status(write_block() ? 0 : -1);
+  case AWAIT_FILENAME:
+    memset(filename, 0, sizeof(filename));
+    memcpy(filename, input, input_length);
+    await(AWAIT_CHECKSUM, 8);
+    return 1;
+  case AWAIT_CHECKSUM:
+    return queue_status(check_file(input));
+  case AWAIT_TIME:
+    await(AWAIT_COMMAND, 8);
+    return 1;
+  case AWAIT_HASH:
+    memcpy(hash, input, SHA1_HASH_LENGTH);
+    after_ack = ACK_SIGNATURE;
+    return queue_status(0);
+  case AWAIT_ACK:
+    break;
+  }
+  return 0;
+}
+
+static int handle_command(void) {
+  command = uchars_to_uint32(input);
+  uint32_t argument = uchars_to_uint32(input + 4);
+  after_ack = ACK_IDLE;
+
+  switch (command) {
+  case READ_BLOCK_ONLY:
+  case READ_BLOCK_AND_SPARE:
+    if (argument >= NUM_BLOCKS) {
+      return queue_status(-1);
+    }
+    block_number = argument;
+    with_spare = (command == READ_BLOCK_AND_SPARE);
+    next_chunk = 0;
+    after_ack = ACK_NEXT_CHUNK;
+    return queue_status(0);
+  case WRITE_BLOCK_ONLY:
+  case WRITE_BLOCK_AND_SPARE:
+    if (argument >= NUM_BLOCKS) {
+      return queue_status(-1);
+    }
+    block_number = argument;
+    with_spare = (command == WRITE_BLOCK_AND_SPARE);
+    await(AWAIT_BLOCK, BLOCK_SIZE);
+    return 1;
+  case GET_NUM_BLOCKS:
+    return queue_status(NUM_BLOCKS);
+  case GET_BBID:
+    return queue_status(CONSOLE_MODEL_BBID);
+  case SET_TIME:
+    after_ack = ACK_TIME;
+    return queue_status(0);
+  case FILE_CHKSUM:
+    if (argument == 0 || argument > sizeof(filename)) {
+      return queue_status(-1);
+    }
+    await(AWAIT_FILENAME, argument);
+    return 1;
+  case SIGN_HASH:
+    if (argument != SHA1_HASH_LENGTH) {
+      return queue_status(-1);
+    }
+    await(AWAIT_HASH, argument);
+    return 1;
+  case INIT_FS:
+  case SET_SEQNO:
+  case GET_SEQNO:
+  case SET_LED:
+    return queue_status(0);
+  default:
+    return queue_status(-1);
+  }
+}
+
+static int handle_ack(void) {
+  if (step != AWAIT_ACK || message_count != 0) {
+    fprintf(stderr, "Console model: unexpected acknowledgement.\n");
+    return 0;
+  }
+
+  switch (after_ack) {
+  case ACK_NEXT_CHUNK:
+    if (next_chunk < CHUNKS_PER_BLOCK) {
+      return queue_chunk();
+    }
+    if (with_spare) {
+      with_spare = 0;
+      return queue_reply(spares[block_number], SPARE_SIZE);
+    }
+    break;
+  case ACK_TIME:
+    after_ack = ACK_IDLE;
+    await(AWAIT_TIME, 4);
+    return 1;
+  case ACK_SIGNATURE: {
+    // Not a real signature, but stable for a given hash.
+    unsigned char signature[ECC_SIG_LENGTH];
+    for (size_t i = 0; i < ECC_SIG_LENGTH; ++i) {
+      signature[i] = (unsigned char)(hash[i % SHA1_HASH_LENGTH] ^ i);
+    }
+    after_ack = ACK_IDLE;
+    return queue_reply(signature, ECC_SIG_LENGTH);
+  }
+  case ACK_IDLE:
+    break;
+  }
+
+  after_ack = ACK_IDLE;
+  await(AWAIT_COMMAND, 8);
+  return 1;
+}
+
+static int queue_chunk(void) {
+  unsigned char chunk[BLOCK_CHUNK_SIZE];
+  if (!read_nand(block_number, next_chunk * BLOCK_CHUNK_SIZE, chunk,
+                 BLOCK_CHUNK_SIZE)) {
+    fprintf(stderr, "Console model: could not read block 0x%04x.\n",
+            block_number);
+    return 0;
+  }
+  ++next_chunk;
+  return queue_reply(chunk, BLOCK_CHUNK_SIZE);
+}
+
+static int queue_status(int32_t status) {
+  unsigned char reply[8];
+  uint32_to_uchars(reply, command);
+  uint32_to_uchars(reply + 4, (uint32_t)status);
+  return queue_reply(reply, sizeof(reply));
+}
+
+static int queue_reply(const unsigned char *data, size_t length) {
+  unsigned char header[4];
+  uint32_to_uchars(header, (uint32_t)length);
+  header[0] = 0x1B;
+
+  unsigned char framed[((BLOCK_CHUNK_SIZE + 2) / 3) * 4];
+  size_t framed_length = 0;
+  for (size_t i = 0; i < length; i += 3) {
+    size_t n = (length - i < 3) ? length - i : 3;
+    memset(framed + framed_length, 0, 4);
+    framed[framed_length] = (unsigned char)(0x1C + n);
+    memcpy(framed + framed_length + 1, data + i, n);
+    framed_length += 4;
+  }
+
+  await(AWAIT_ACK, 0);
+  return queue_message(header, sizeof(header)) &&
+         queue_message(framed, framed_length);
+}
+
+static int queue_message(const unsigned char *data, size_t length) {
+  if (message_count == MODEL_MAX_MESSAGES ||
+      out_end + length > MODEL_OUT_SIZE) {
+    fprintf(stderr, "Console model: too many messages queued.\n");
+    return 0;
+  }
+  memcpy(out_buffer + out_end, data, length);
+  out_end += length;
+  message_ends[message_count++] = out_end;
+  return 1;
+}
+
+/*
+    FILE_CHKSUM: compares the byte sum of the first size bytes of a file
+    with the host's. Returns 0 if they match, -1 otherwise.
+*/
+static int32_t check_file(const unsigned char *params) {
+  uint32_t checksum = uchars_to_uint32((unsigned char *)params);
+  uint32_t size = uchars_to_uint32((unsigned char *)params + 4);
+
+  static unsigned char fs[BLOCK_SIZE];
+  if (!load_current_fs(fs)) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < NUM_FILE_ENTRIES; ++i) {
+    const unsigned char *entry = fs + FILE_ENTRIES_START + i * FILE_ENTRY_SIZE;
+    char name[13] = {0};
+    size_t name_length = field_length(entry, 8);
+    size_t ext_length = field_length(entry + 8, 3);
+    if (name_length == 0 || entry[0xB] == 0) {
+      continue;
+    }
+    memcpy(name, entry, name_length);
+    name[name_length] = '.';
+    memcpy(name + name_length + 1, entry + 8, ext_length);
+    if (strcmp(name, filename) != 0) {
+      continue;
+    }
+
+    uint32_t sum = 0;
+    uint32_t remaining = size;
+    int16_t block = uchars_to_int16((unsigned char *)entry + 0xC);
+    unsigned char data[BLOCK_SIZE];
+    while (remaining && block >= 0 && block < NUM_BLOCKS) {
+      uint32_t count = (remaining < BLOCK_SIZE) ? remaining : BLOCK_SIZE;
+      if (!read_nand((uint32_t)block, 0, data, count)) {
+        return -1;
+      }
+      for (uint32_t j = 0; j < count; ++j) {
+        sum += data[j];
+      }
+      remaining -= count;
+      block = uchars_to_int16(&fs[block * 2]);
+    }
+    return (remaining == 0 && sum == checksum) ? 0 : -1;
+  }
+  return -1;
+}
+
+// The filesystem block with the highest sequence number
+static int load_current_fs(unsigned char *fs) {
+  static unsigned char candidate[BLOCK_SIZE];
+  uint32_t best = 0;
+  for (uint32_t i = FS_FIRST_BLOCK; i < FS_FIRST_BLOCK + FS_BLOCK_COUNT; ++i) {
+    if (!read_nand(i, 0, candidate, BLOCK_SIZE)) {
+      return 0;
+    }
+    uint32_t seqno = uchars_to_uint32(&candidate[0x3FF8]);
+    if (seqno > best && seqno != 0xFFFFFFFF) {
+      best = seqno;
+      memcpy(fs, candidate, BLOCK_SIZE);
+    }
+  }
+  return (best != 0);
+}
+
+// Length of a name field that is only NUL-terminated when it is not full
+static size_t field_length(const unsigned char *field, size_t size) {
+  const unsigned char *end = memchr(field, 0, size);
+  return end ? (size_t)(end - field) : size;
+}
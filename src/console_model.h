@@ -0,0 +1,37 @@
+/*
+    console_model.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_CONSOLE_MODEL_H
+#define AULON_CONSOLE_MODEL_H
+
+#include "usb.h"
+
+/*
+    A software iQue Player for running aulon without a console (-m).
+    It speaks the player's USB protocol over a NAND image on disk:
+    image_path holds the blocks, and the spare data is kept in a file next
+    to it (nand.bin -> spare.bin, otherwise image_path + ".spare"). Missing
+    files are created as a blank NAND with an empty filesystem.
+*/
+#define CONSOLE_MODEL_BBID 0x00001234
+
+void console_model_set_image(char * image_path);
+const struct usb_transport * console_model_transport(void);
+
+#endif
@@ -0,0 +1,191 @@
+/*
+    dump_journal.c
+    journal of completed blocks for resumable NAND dumps
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "commands.h"
+#include "dump_journal.h"
+#include "io.h"
+
+#ifdef GUI_BUILD
+#include "gui_redirect.h"
+#endif
+
+/*
+    File format (all numbers big-endian):
+        header: "AULJ", version (u32), BBID (u32), number of blocks (u32)
+        record: block number (u32), hash of the block and spare (u64)
+    A record is appended and flushed after the block has been flushed to
+    the dump files, so every complete record describes data on disk. A
+    partial record at the end (from a crash) is ignored.
+*/
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 16
+#define JOURNAL_RECORD_SIZE 12
+
+static const unsigned char JOURNAL_MAGIC[4] = {'A', 'U', 'L', 'J'};
+
+static FILE *journal_file = NULL;
+static char journal_path[260] = {0};
+static unsigned char verified_blocks[NUM_BLOCKS];
+static uint64_t block_hashes[NUM_BLOCKS];
+
+static int read_header(FILE *file, uint32_t bbid);
+static int write_header(uint32_t bbid);
+static int append_record(uint32_t block, uint64_t hash);
+static int block_matches(FILE *nand_file, FILE *spare_file, uint32_t block,
+                         uint64_t hash);
+
+int dump_journal_resumable(const char *path, uint32_t bbid) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return 0;
+  }
+  int r = read_header(file, bbid);
+  fclose(file);
+  return r;
+}
+
+int dump_journal_open(const char *path, uint32_t bbid, FILE *nand_file,
+                      FILE *spare_file, uint32_t *verified) {
+  memset(verified_blocks, 0, sizeof(verified_blocks));
+  *verified = 0;
+  if (strlen(path) >= sizeof(journal_path)) {
+    fprintf(stderr, "Journal path is too long.\n");
+    return 0;
+  }
+  strcpy(journal_path, path);
+
+  // Keep the records whose blocks are intact in the dump files.
+  FILE *old = NULL;
+  if (nand_file && spare_file && (old = fopen(path, "rb")) != NULL) {
+    if (read_header(old, bbid)) {
+      unsigned char record[JOURNAL_RECORD_SIZE];
+      while (fread(record, 1, JOURNAL_RECORD_SIZE, old) ==
+             JOURNAL_RECORD_SIZE) {
+        uint32_t block = uchars_to_uint32(record);
+        uint64_t hash = ((uint64_t)uchars_to_uint32(record + 4) << 32) |
+                        uchars_to_uint32(record + 8);
+        if (block < NUM_BLOCKS && !verified_blocks[block] &&
+            block_matches(nand_file, spare_file, block, hash)) {
+          verified_blocks[block] = 1;
+          block_hashes[block] = hash;
+          ++*verified;
+        }
+      }
+    }
+    fclose(old);
+  }
+
+  // Rewrite the journal with only the verified blocks.
+  if (!open_file(&journal_file, path, "wb") || !write_header(bbid)) {
+    dump_journal_close(0);
+    return 0;
+  }
+  for (uint32_t block = 0; block < NUM_BLOCKS; ++block) {
+    if (verified_blocks[block] && !append_record(block, block_hashes[block])) {
+      dump_journal_close(0);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int dump_journal_block_verified(uint32_t block) {
+  return (block < NUM_BLOCKS) && verified_blocks[block];
+}
+
+int dump_journal_record(uint32_t block, const unsigned char *block_data,
+                        const unsigned char *spare_data) {
+  if (block >= NUM_BLOCKS ||
+      !append_record(block, dump_journal_hash(block_data, spare_data))) {
+    return 0;
+  }
+  verified_blocks[block] = 1;
+  return 1;
+}
+
+static int append_record(uint32_t block, uint64_t hash) {
+  if (journal_file == NULL) {
+    return 0;
+  }
+  unsigned char record[JOURNAL_RECORD_SIZE];
+  uint32_to_uchars(record, block);
+  uint32_to_uchars(record + 4, (uint32_t)(hash >> 32));
+  uint32_to_uchars(record + 8, (uint32_t)hash);
+  if (fwrite(record, 1, JOURNAL_RECORD_SIZE, journal_file) !=
+          JOURNAL_RECORD_SIZE ||
+      fflush(journal_file) != 0) {
+    fprintf(stderr, "Error writing to the dump journal.\n");
+    return 0;
+  }
+  return 1;
+}
+
+void dump_journal_close(int complete) {
+  if (journal_file) {
+    fclose(journal_file);
+    journal_file = NULL;
+  }
+  if (complete && journal_path[0]) {
+    remove(journal_path);
+  }
+  journal_path[0] = '\0';
+}
+
+uint64_t dump_journal_hash(const unsigned char *block_data,
+                           const unsigned char *spare_data) {
+  uint64_t hash = fnv1a_64(block_data, BLOCK_SIZE, FNV1A_64_INIT);
+  return fnv1a_64(spare_data, SPARE_SIZE, hash);
+}
+
+static int read_header(FILE *file, uint32_t bbid) {
+  unsigned char header[JOURNAL_HEADER_SIZE];
+  return fread(header, 1, JOURNAL_HEADER_SIZE, file) == JOURNAL_HEADER_SIZE &&
+         memcmp(header, JOURNAL_MAGIC, 4) == 0 &&
+         uchars_to_uint32(header + 4) == JOURNAL_VERSION &&
+         uchars_to_uint32(header + 8) == bbid &&
+         uchars_to_uint32(header + 12) == NUM_BLOCKS;
+}
+
+static int write_header(uint32_t bbid) {
+  unsigned char header[JOURNAL_HEADER_SIZE];
+  memcpy(header, JOURNAL_MAGIC, 4);
+  uint32_to_uchars(header + 4, JOURNAL_VERSION);
+  uint32_to_uchars(header + 8, bbid);
+  uint32_to_uchars(header + 12, NUM_BLOCKS);
+  return fwrite(header, 1, JOURNAL_HEADER_SIZE, journal_file) ==
+             JOURNAL_HEADER_SIZE &&
+         fflush(journal_file) == 0;
+}
+
+static int block_matches(FILE *nand_file, FILE *spare_file, uint32_t block,
+                         uint64_t hash) {
+  static unsigned char block_data[BLOCK_SIZE];
+  unsigned char spare_data[SPARE_SIZE];
+  return fseek(nand_file, (long)block * BLOCK_SIZE, SEEK_SET) == 0 &&
+         fread(block_data, 1, BLOCK_SIZE, nand_file) == BLOCK_SIZE &&
+         fseek(spare_file, (long)block * SPARE_SIZE, SEEK_SET) == 0 &&
+         fread(spare_data, 1, SPARE_SIZE, spare_file) == SPARE_SIZE &&
+         dump_journal_hash(block_data, spare_data) == hash;
+}
@@ -0,0 +1,53 @@
+/*
+    dump_journal.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_DUMP_JOURNAL_H
+#define AULON_DUMP_JOURNAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+    Sidecar journal of a NAND dump in progress. Every block written to the
+    dump files is recorded with a hash of its data and spare, so an
+    interrupted dump of the same console (same BBID) can be resumed: blocks
+    whose data in the files still matches their hash are not read again.
+
+    dump_journal_resumable returns 1 if path holds a journal for bbid.
+    dump_journal_open starts a new journal, or with nand_file and
+    spare_file given, loads the existing one and checks its blocks against
+    the files; *verified is set to the number of blocks that can be kept.
+    It returns 1 for success and 0 for failure, as does dump_journal_record.
+    dump_journal_close deletes the journal when the dump is complete.
+*/
+#define DUMP_JOURNAL_FILENAME "nand.journal"
+
+int dump_journal_resumable(const char * path, uint32_t bbid);
+int dump_journal_open(const char * path, uint32_t bbid, FILE * nand_file,
+                      FILE * spare_file, uint32_t * verified);
+int dump_journal_block_verified(uint32_t block);
+int dump_journal_record(uint32_t block, const unsigned char * block_data,
+                        const unsigned char * spare_data);
+void dump_journal_close(int complete);
+
+// FNV-1a (64-bit) hash of a block and its spare
+uint64_t dump_journal_hash(const unsigned char * block_data,
+                           const unsigned char * spare_data);
+
+#endif
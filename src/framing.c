@@ -0,0 +1,362 @@
+/*
+    framing.c
+    encoding and decoding of the transfer units used by the iQue Player
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stddef.h>
+#include <string.h>
+
+#include "framing.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||           \
+    defined(_M_IX86)
+#define FRAMING_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(FRAMING_X86) && defined(__GNUC__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+/*
+    Encoding
+    Host-to-player data is split into 3-byte sections tagged 0x43, with one
+    shorter section at the end if needed. The vector kernels expand whole
+    sections -- 12 bytes into 16 with SSSE3, 24 into 32 with AVX2 -- and leave
+    the remainder to the scalar loop. They load a whole vector, so they only
+    run while that much input is left.
+*/
+typedef void (*encode_kernel)(const unsigned char *in, size_t in_length,
+                              size_t *in_offset, unsigned char *out,
+                              size_t *out_offset);
+
+static void encode_none(const unsigned char *in, size_t in_length,
+                        size_t *in_offset, unsigned char *out,
+                        size_t *out_offset) {
+  (void)in;
+  (void)in_length;
+  (void)in_offset;
+  (void)out;
+  (void)out_offset;
+}
+
+#ifdef FRAMING_X86
+TARGET_SSSE3 static void encode_ssse3(const unsigned char *in,
+                                      size_t in_length, size_t *in_offset,
+                                      unsigned char *out, size_t *out_offset) {
+  const __m128i expand = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8,
+                                       -1, 9, 10, 11);
+  const __m128i tags = _mm_set1_epi32(0x43);
+  size_t i = *in_offset;
+  size_t o = *out_offset;
+
+  while (i + 16 <= in_length) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i sections = _mm_or_si128(_mm_shuffle_epi8(v, expand), tags);
+    _mm_storeu_si128((__m128i *)(out + o), sections);
+    i += 12;
+    o += 16;
+  }
+
+  *in_offset = i;
+  *out_offset = o;
+}
+
+TARGET_AVX2 static void encode_avx2(const unsigned char *in, size_t in_length,
+                                    size_t *in_offset, unsigned char *out,
+                                    size_t *out_offset) {
+  // Gives the upper lane the second 12 bytes of input
+  const __m256i split = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+  const __m256i expand = _mm256_setr_epi8(
+      -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3,
+      4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+  const __m256i tags = _mm256_set1_epi32(0x43);
+  size_t i = *in_offset;
+  size_t o = *out_offset;
+
+  while (i + 32 <= in_length) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+    v = _mm256_permutevar8x32_epi32(v, split);
+    __m256i sections = _mm256_or_si256(_mm256_shuffle_epi8(v, expand), tags);
+    _mm256_storeu_si256((__m256i *)(out + o), sections);
+    i += 24;
+    o += 32;
+  }
+
+  *in_offset = i;
+  *out_offset = o;
+  encode_ssse3(in, in_length, in_offset, out, out_offset);
+}
+#endif
+
+/*
+    Decoding
+    Every unit received from the player is 4 bytes: a tag of 0x1C + n
+    followed by n (1-3) bytes of data. All units of a reply are full (0x1F)
+    except possibly the last one, so the vector kernels only handle runs of
+    full units -- 4 units (16 bytes) become 12 bytes of data with SSSE3, 8
+    units (32 bytes) become 24 bytes with AVX2. They stop at anything else
+    and leave it to the scalar loop.
+
+    The kernels store a whole vector, so they only run while the output buffer
+    has room for one; the bytes past the decoded data are overwritten by the
+    next unit (or are outside the expected data and never looked at).
+*/
+typedef void (*decode_kernel)(const unsigned char *in, size_t in_length,
+                              size_t *in_offset, unsigned char *out,
+                              size_t out_length, size_t *out_offset);
+
+static void decode_none(const unsigned char *in, size_t in_length,
+                        size_t *in_offset, unsigned char *out,
+                        size_t out_length, size_t *out_offset) {
+  (void)in;
+  (void)in_length;
+  (void)in_offset;
+  (void)out;
+  (void)out_length;
+  (void)out_offset;
+}
+
+#ifdef FRAMING_X86
+TARGET_SSSE3 static void decode_ssse3(const unsigned char *in,
+                                      size_t in_length, size_t *in_offset,
+                                      unsigned char *out, size_t out_length,
+                                      size_t *out_offset) {
+  const __m128i tag = _mm_set1_epi8(0x1F);
+  const __m128i compact = _mm_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14,
+                                        15, -1, -1, -1, -1);
+  size_t i = *in_offset;
+  size_t o = *out_offset;
+
+  while (i + 16 <= in_length && o + 16 <= out_length) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    int tags = _mm_movemask_epi8(_mm_cmpeq_epi8(v, tag));
+    if ((tags & 0x1111) != 0x1111) {
+      break;
+    }
+    _mm_storeu_si128((__m128i *)(out + o), _mm_shuffle_epi8(v, compact));
+    i += 16;
+    o += 12;
+  }
+
+  *in_offset = i;
+  *out_offset = o;
+}
+
+TARGET_AVX2 static void decode_avx2(const unsigned char *in, size_t in_length,
+                                    size_t *in_offset, unsigned char *out,
+                                    size_t out_length, size_t *out_offset) {
+  const __m256i tag = _mm256_set1_epi8(0x1F);
+  const __m256i compact = _mm256_setr_epi8(
+      1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1, 1, 2, 3, 5, 6, 7,
+      9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+  // Moves the 12 bytes of the upper lane down next to those of the lower one
+  const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  size_t i = *in_offset;
+  size_t o = *out_offset;
+
+  while (i + 32 <= in_length && o + 32 <= out_length) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+    unsigned int tags =
+        (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, tag));
+    if ((tags & 0x11111111u) != 0x11111111u) {
+      break;
+    }
+    __m256i data = _mm256_shuffle_epi8(v, compact);
+    _mm256_storeu_si256((__m256i *)(out + o),
+                        _mm256_permutevar8x32_epi32(data, join));
+    i += 32;
+    o += 24;
+  }
+
+  *in_offset = i;
+  *out_offset = o;
+  decode_ssse3(in, in_length, in_offset, out, out_length, out_offset);
+}
+#endif
+
+/*
+    CPU feature detection
+*/
+static int cpu_has_ssse3(void) {
+#if defined(FRAMING_X86) && defined(__GNUC__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("ssse3");
+#elif defined(FRAMING_X86) && defined(_MSC_VER)
+  int info[4] = {0};
+  __cpuid(info, 1);
+  return (info[2] & (1 << 9)) != 0;
+#else
+  return 0;
+#endif
+}
+
+static int cpu_has_avx2(void) {
+#if defined(FRAMING_X86) && defined(__GNUC__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#elif defined(FRAMING_X86) && defined(_MSC_VER) && (_MSC_VER >= 1700)
+  int info[4] = {0};
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return 0;
+  }
+  // The OS must also save the YMM registers (OSXSAVE + XCR0 bits 1 and 2)
+  __cpuid(info, 1);
+  if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 0x6) != 0x6) {
+    return 0;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return 0;
+#endif
+}
+
+static int kernel_selected = 0;
+static enum framing_kernel current_kernel = FRAMING_SCALAR;
+static decode_kernel current_decode = decode_none;
+static encode_kernel current_encode = encode_none;
+
+int framing_kernel_supported(enum framing_kernel kernel) {
+  switch (kernel) {
+  case FRAMING_SCALAR:
+    return 1;
+  case FRAMING_SSSE3:
+    return cpu_has_ssse3();
+  case FRAMING_AVX2:
+    return cpu_has_ssse3() && cpu_has_avx2();
+  default:
+    return 0;
+  }
+}
+
+const char *framing_kernel_name(enum framing_kernel kernel) {
+  switch (kernel) {
+  case FRAMING_SCALAR:
+    return "scalar";
+  case FRAMING_SSSE3:
+    return "SSSE3";
+  case FRAMING_AVX2:
+    return "AVX2";
+  default:
+    return "unknown";
+  }
+}
+
+int framing_use_kernel(enum framing_kernel kernel) {
+  if (!framing_kernel_supported(kernel)) {
+    return 0;
+  }
+
+  current_kernel = kernel;
+  current_decode = decode_none;
+  current_encode = encode_none;
+#ifdef FRAMING_X86
+  if (kernel == FRAMING_SSSE3) {
+    current_decode = decode_ssse3;
+    current_encode = encode_ssse3;
+  } else if (kernel == FRAMING_AVX2) {
+    current_decode = decode_avx2;
+    current_encode = encode_avx2;
+  }
+#endif
+  kernel_selected = 1;
+  return 1;
+}
+
+static void select_kernel(void) {
+  if (!framing_use_kernel(FRAMING_AVX2) && !framing_use_kernel(FRAMING_SSSE3)) {
+    framing_use_kernel(FRAMING_SCALAR);
+  }
+}
+
+enum framing_kernel framing_get_kernel(void) {
+  if (!kernel_selected) {
+    select_kernel();
+  }
+  return current_kernel;
+}
+
+/*
+    Encoding and decoding
+*/
+size_t framing_encode_piecemeal(const unsigned char *in, size_t in_length,
+                                unsigned char *out) {
+  if (!kernel_selected) {
+    select_kernel();
+  }
+
+  size_t i = 0;
+  size_t o = 0;
+  current_encode(in, in_length, &i, out, &o);
+
+  while (i < in_length) {
+    size_t section_length = (in_length - i >= 3) ? 3 : in_length - i;
+    out[o] = (unsigned char)(0x40 + section_length);
+    memcpy(out + o + 1, in + i, section_length);
+    o += section_length + 1;
+    i += section_length;
+  }
+
+  return o;
+}
+
+int framing_decode(const unsigned char *in, size_t in_length,
+                   size_t *in_offset, unsigned char *out, size_t out_length,
+                   size_t *out_offset) {
+  if (!kernel_selected) {
+    select_kernel();
+  }
+
+  size_t i = 0;
+  size_t o = 0;
+  int success = 1;
+
+  while (o < out_length && i < in_length) {
+    current_decode(in, in_length, &i, out, out_length, &o);
+    if (o >= out_length || i >= in_length) {
+      break;
+    }
+
+    // Partial or odd unit, or the tail of the data
+    unsigned char tu = in[i];
+    if (tu != 0x1F && tu != 0x1E && tu != 0x1D) {
+      success = 0;
+      break;
+    }
+    size_t tu_length = tu - 0x1C;
+    if (tu_length > out_length - o || tu_length >= in_length - i) {
+      break;
+    }
+    memcpy(out + o, in + i + 1, tu_length);
+    o += tu_length;
+    i += 4;
+  }
+
+  *in_offset = i;
+  *out_offset = o;
+  return success;
+}
@@ -0,0 +1,64 @@
+/*
+    framing.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_FRAMING_H
+#define AULON_FRAMING_H
+
+#include <stddef.h>
+
+// Implementations of the framing kernels, from slowest to fastest
+enum framing_kernel {
+    FRAMING_SCALAR = 0,
+    FRAMING_SSSE3  = 1,
+    FRAMING_AVX2   = 2
+};
+
+/*
+    Strips the 4-byte transfer units (0x1C + n, followed by n bytes of data)
+    from in[] and writes the data to out[]. Decoding stops when out_length
+    bytes have been produced, the input runs out, or a unit would not fit.
+    *in_offset and *out_offset are set to the amount of input consumed and
+    output produced.
+
+    Returns 1, or 0 if an unknown transfer unit type was found at
+    in[*in_offset].
+*/
+int framing_decode(const unsigned char * in, size_t in_length, size_t * in_offset,
+                   unsigned char * out, size_t out_length, size_t * out_offset);
+
+/*
+    Frames in[] as piecemeal data: sections of up to 3 bytes, each preceded
+    by a tag of 0x40 + the section's length. out[] must have room for
+    FRAMING_PIECEMEAL_LENGTH(in_length) bytes; that length is returned.
+*/
+#define FRAMING_PIECEMEAL_LENGTH(n) ((n) + ((n) + 2) / 3)
+size_t framing_encode_piecemeal(const unsigned char * in, size_t in_length,
+                                unsigned char * out);
+
+/*
+    Kernel selection. The fastest kernel supported by the CPU is chosen the
+    first time it is needed; framing_use_kernel overrides that (returns 0 if
+    the kernel is not supported).
+*/
+enum framing_kernel framing_get_kernel(void);
+int framing_use_kernel(enum framing_kernel kernel);
+int framing_kernel_supported(enum framing_kernel kernel);
+const char * framing_kernel_name(enum framing_kernel kernel);
+
+#endif
@@ -32,11 +32,39 @@
 #include "gui_redirect.h"
 #endif
 #include "fs.h"
+#include "fs_alloc.h"
+#include "fs_cache.h"
+#include "fs_index.h"
 #include "io.h"
+#include "pool.h"
 
 static unsigned char current_fs[BLOCK_SIZE];
 static unsigned char current_sp[SPARE_SIZE];
+// current_sp is only read from the console when an update needs it.
+static int current_sp_loaded = 0;
 static uint32_t current_index = 0;
+// The console whose filesystem is cached, once it is known
+static uint32_t cache_bbid = 0;
+static int cache_bbid_known = 0;
+
+/*
+    Between fs_begin and fs_commit, changes are only made to current_fs.
+    The FS as it was at the outermost fs_begin is kept so that they can be
+    abandoned. The console checks a file's checksum against the FS it has,
+    so the files written in a transaction are checked once it is committed.
+*/
+struct pending_check {
+  char filename[13];
+  uint32_t checksum;
+  uint32_t size;
+};
+
+static int transaction_depth = 0;
+static unsigned char transaction_start_fs[BLOCK_SIZE];
+static struct pending_check pending_checks[NUM_FILE_ENTRIES];
+static size_t pending_count = 0;
+
+static int delete_file(const char *filename);
 
 /*
     Simple utility functions
@@ -47,6 +75,8 @@ static void construct_filename(char *filename, size_t index) {
   strncat(filename, (char *)&current_fs[index + 8], 3);
 }
 
+static int entry_valid(size_t index);
+
 static int set_filename(size_t index, const char *new_fn) {
   size_t full_len = strlen(new_fn);
   size_t fn_len = strcspn(new_fn, ".");
@@ -57,9 +87,16 @@ static int set_filename(size_t index, const char *new_fn) {
     return 0;
   }
 
+  int indexed = entry_valid(index);
+  if (indexed) {
+    fs_index_remove(current_fs, index);
+  }
   memset(&current_fs[index], 0, 11);
   memcpy(&current_fs[index], new_fn, fn_len);
   memcpy(&current_fs[index + 8], (new_fn + fn_len + 1), ext_len);
+  if (indexed) {
+    fs_index_add(current_fs, index);
+  }
   return 1;
 }
 
@@ -78,20 +115,30 @@ static int entry_valid(size_t index) {
   return 1;
 }
 
-static size_t find_file(const char *filename) {
-  size_t result = 0;
+/*
+    The valid entries of current_fs are kept in a hash index by name, so
+    that files are found without scanning all of the entries.
+*/
+static void build_file_index(void) {
+  fs_index_clear();
   for (size_t i = 0; i < NUM_FILE_ENTRIES; ++i) {
     size_t index = FILE_ENTRIES_START + (i * FILE_ENTRY_SIZE);
     if (entry_valid(index)) {
-      char test_fn[13] = {0};
-      construct_filename(test_fn, index);
-      if (strcmp(filename, test_fn) == 0) {
-        result = index;
-        break;
-      }
+      fs_index_add(current_fs, index);
     }
   }
-  return result;
+}
+
+// After current_fs is replaced as a whole; any open transaction is dropped.
+static void reset_fs_state(void) {
+  transaction_depth = 0;
+  pending_count = 0;
+  build_file_index();
+  fs_alloc_build(current_fs);
+}
+
+static size_t find_file(const char *filename) {
+  return fs_index_find(current_fs, filename);
 }
 
 static int rename_file(const char *old_fn, const char *new_fn) {
@@ -108,22 +155,21 @@ static uint32_t bytes_to_blocks(uint32_t bytes) {
   return (bytes / BLOCK_SIZE) + (bytes % BLOCK_SIZE != 0);
 }
 
-static uint32_t get_file_block_count(const char *filename) {
-  size_t index = find_file(filename);
-  if (index == 0) {
-    fprintf(stderr, "Error calculating block count of file: file not found\n");
-    return 0;
-  }
+static uint32_t get_entry_block_count(size_t index) {
   return bytes_to_blocks(uchars_to_uint32(&current_fs[index + 0x10]));
 }
 
-static uint32_t get_free_block_count(void) {
-  uint32_t result = 0;
-  for (int i = 0; i < 0x2000; i += 2) {
-    if (uchars_to_int16(&current_fs[i]) == 0)
-      result++;
-  }
-  return result;
+static uint32_t get_free_block_count(void) { return fs_alloc_free_count(); }
+
+/*
+    All changes to the FAT go through here, to keep the free block map in
+    step with it.
+*/
+static void set_fat_entry(int16_t block, int16_t value) {
+  fs_alloc_update((uint32_t)block, uchars_to_int16(&current_fs[block * 2]),
+                  value);
+  current_fs[block * 2] = (value & 0xFF00) >> 8;
+  current_fs[block * 2 + 1] = (value & 0x00FF);
 }
 
 /*
@@ -156,9 +202,30 @@ static void increment_seqno(void) {
   current_fs[0x3FFB] = (seqno & 0x000000FF);
 }
 
+static int load_current_spare(void) {
+  if (current_sp_loaded) {
+    return 1;
+  }
+  unsigned char *block_temp = pool_acquire(BLOCK_SIZE);
+  if (block_temp == NULL) {
+    fprintf(stderr, "Could not allocate memory for reading the FS spare!\n");
+    return 0;
+  }
+  current_sp_loaded =
+      read_block_spare(block_temp, current_sp, current_index + 0xFF0);
+  pool_release(block_temp);
+  if (!current_sp_loaded) {
+    fprintf(stderr, "Could not read the spare of the current FS block!\n");
+  }
+  return current_sp_loaded;
+}
+
 static int update_fs(void) {
   uint32_t next_index = ((current_index - 1) % 16) + 0xFF0;
 
+  if (!load_current_spare()) {
+    return 0;
+  }
   increment_seqno();
 
   if (!write_block_spare(current_fs, current_sp, next_index)) {
@@ -175,47 +242,214 @@ static int update_fs(void) {
     fprintf(stderr, "Filesystem not synchronized! Resetting the console should "
                     "do it for you.\n");
   }
-  current_index = next_index;
+  current_index = next_index - 0xFF0;
+  if (cache_bbid_known) {
+    fs_cache_store(cache_bbid, current_fs, current_index);
+  }
   return 1;
 }
 
 /*
     Find the current up-to-date filesystem and its block
 */
-static uint32_t check_seqno(unsigned char *block, unsigned char *spare,
-                            uint32_t block_num, uint32_t current_seqno) {
-  if (!read_block_spare(block, spare, block_num)) {
-    fprintf(stderr, "Unable to read all FS blocks!\n");
-    return 0;
-  }
-
+static int check_seqno(uint32_t block_num, unsigned char *block,
+                       unsigned char *spare, void *context) {
+  uint32_t *current_seqno = context;
   uint32_t seqno = uchars_to_uint32(&block[0x3FF8]);
-  if (seqno > current_seqno) {
+  (void)spare;
+  // On a tie the highest block wins.
+  if (seqno != 0 && seqno >= *current_seqno) {
     memcpy(current_fs, block, BLOCK_SIZE);
-    memcpy(current_sp, spare, SPARE_SIZE);
     current_index = block_num - 0xFF0;
-    return seqno;
+    *current_seqno = seqno;
   }
+  return 1;
+}
 
-  return current_seqno;
+// Reloading the FS replaces current_fs, and with it any staged changes.
+static void discard_transaction(void) {
+  if (fs_in_transaction()) {
+    fs_abort();
+    fprintf(stderr, "The file changes staged in the open batch were "
+                    "discarded.\n");
+  }
 }
 
 int get_current_fs(void) {
+  discard_transaction();
   uint32_t current_seqno = 0;
+  current_sp_loaded = 0;
+  int success = read_blocks(0xFF0, 16, 0, check_seqno, &current_seqno);
+  // current_fs may have changed even if not all blocks could be read.
+  reset_fs_state();
+  if (!success) {
+    fprintf(stderr, "Unable to read all FS blocks!\n");
+    return 0;
+  }
+  if (current_seqno != 0 && cache_bbid_known) {
+    fs_cache_store(cache_bbid, current_fs, current_index);
+  }
+  return (current_seqno != 0);
+}
 
-  unsigned char *block_temp = calloc(BLOCK_SIZE, sizeof(unsigned char));
-  unsigned char *spare_temp = calloc(SPARE_SIZE, sizeof(unsigned char));
-  if (block_temp == NULL || spare_temp == NULL) {
-    fprintf(stderr, "Could not allocate memory for analyzing FS!\n");
-  } else {
-    for (uint32_t i = 0xFFF; i >= 0xFF0; --i) {
-      current_seqno = check_seqno(block_temp, spare_temp, i, current_seqno);
+/*
+    A cached FS block is still current if the console holds it unchanged,
+    and the block the next update would go to (see update_fs) does not
+    hold a newer one. That takes two block reads instead of sixteen.
+    It relies on the console writing each update to that block, so it is
+    not trusted if the cached FAT has any FS block marked as anything but
+    reserved (a bad one, say, which the console would skip).
+*/
+static int fs_blocks_reserved(const unsigned char *fs) {
+  for (uint32_t block = 0xFF0; block < NUM_BLOCKS; ++block) {
+    if (uchars_to_int16((unsigned char *)&fs[block * 2]) != -3) {
+      return 0;
     }
   }
+  return 1;
+}
 
-  free(block_temp);
-  free(spare_temp);
-  return (current_seqno != 0);
+static int cached_fs_current(unsigned char *cached, unsigned char *block,
+                             uint32_t index) {
+  uint32_t seqno = uchars_to_uint32(&cached[0x3FF8]);
+  uint32_t next_index = (index - 1) % 16;
+  return seqno != 0 && fs_blocks_reserved(cached) &&
+         read_block_only(block, 0xFF0 + index) &&
+         memcmp(block, cached, BLOCK_SIZE) == 0 &&
+         read_block_only(block, 0xFF0 + next_index) &&
+         uchars_to_uint32(&block[0x3FF8]) < seqno;
+}
+
+/*
+    Like get_current_fs, but try the FS block cached for this console
+    first. The cache is kept up to date from then on.
+*/
+int get_current_fs_cached(uint32_t bbid) {
+  discard_transaction();
+  cache_bbid = bbid;
+  cache_bbid_known = 1;
+
+  uint32_t index = 0;
+  unsigned char *cached = pool_acquire(BLOCK_SIZE);
+  unsigned char *block = pool_acquire(BLOCK_SIZE);
+  int valid = cached != NULL && block != NULL &&
+              fs_cache_load(bbid, cached, &index) &&
+              cached_fs_current(cached, block, index);
+  if (valid) {
+    memcpy(current_fs, cached, BLOCK_SIZE);
+    current_index = index;
+    current_sp_loaded = 0;
+    reset_fs_state();
+  }
+  pool_release(cached);
+  pool_release(block);
+
+  return valid || get_current_fs();
+}
+
+/*
+    Transactions: stage changes to the filesystem and write them to the
+    console in a single update.
+*/
+static struct pending_check *find_pending_check(const char *filename) {
+  for (size_t i = 0; i < pending_count; ++i) {
+    if (strcmp(pending_checks[i].filename, filename) == 0) {
+      return &pending_checks[i];
+    }
+  }
+  return NULL;
+}
+
+static void remove_pending_check(const char *filename) {
+  struct pending_check *check = find_pending_check(filename);
+  if (check != NULL) {
+    *check = pending_checks[--pending_count];
+  }
+}
+
+static void add_pending_check(const char *filename, uint32_t checksum,
+                              uint32_t size) {
+  struct pending_check *check = find_pending_check(filename);
+  if (check == NULL) {
+    if (pending_count == NUM_FILE_ENTRIES) {
+      return;
+    }
+    check = &pending_checks[pending_count++];
+  }
+  strcpy(check->filename, filename);
+  check->checksum = checksum;
+  check->size = size;
+}
+
+/*
+    Files whose checksum does not match on the console are deleted again,
+    with a second update.
+*/
+static int check_written_files(void) {
+  int all_match = 1;
+  for (size_t i = 0; i < pending_count; ++i) {
+    struct pending_check *check = &pending_checks[i];
+    if (!file_checksum_cmp(check->filename, check->checksum, check->size)) {
+      fprintf(stderr,
+              "Checksum of '%s' on the console is incorrect! Deleting it.\n",
+              check->filename);
+      delete_file(check->filename);
+      all_match = 0;
+    }
+  }
+  pending_count = 0;
+  if (!all_match) {
+    update_fs();
+  }
+  return all_match;
+}
+
+void fs_begin(void) {
+  if (transaction_depth++ == 0) {
+    memcpy(transaction_start_fs, current_fs, BLOCK_SIZE);
+    pending_count = 0;
+    fs_alloc_hold_freed(1);
+  }
+}
+
+int fs_commit(void) {
+  if (transaction_depth == 0) {
+    fprintf(stderr, "There is no filesystem transaction to commit.\n");
+    return 0;
+  }
+  if (--transaction_depth > 0) {
+    return 1;
+  }
+
+  fs_alloc_hold_freed(0);
+  if (memcmp(current_fs, transaction_start_fs, BLOCK_SIZE) == 0) {
+    fs_alloc_release_held();
+    return 1;
+  }
+  // Blocks freed in the transaction stay held if the update fails, as the
+  // console's filesystem may still use them.
+  if (!update_fs()) {
+    pending_count = 0;
+    return 0;
+  }
+  fs_alloc_release_held();
+  return check_written_files();
+}
+
+void fs_abort(void) {
+  if (transaction_depth > 0) {
+    memcpy(current_fs, transaction_start_fs, BLOCK_SIZE);
+    reset_fs_state();
+  }
+}
+
+int fs_in_transaction(void) { return transaction_depth > 0; }
+
+// Whether the entry is the same as in the filesystem the console has
+static int entry_committed(size_t index) {
+  return transaction_depth == 0 ||
+         memcmp(&current_fs[index], &transaction_start_fs[index],
+                FILE_ENTRY_SIZE) == 0;
 }
 
 /*
@@ -267,17 +501,23 @@ void list_files(void) {
 /*
     Delete a file on the console.
 */
-static void free_blocks(size_t index) {
-  int16_t next_block = uchars_to_int16(&current_fs[index + 0xC]);
+static void free_chain(int16_t first_block) {
+  int16_t next_block = first_block;
   while (next_block >= 0) {
     int16_t curr_block = next_block;
     next_block = uchars_to_int16(&current_fs[curr_block * 2]);
-    current_fs[(curr_block * 2)] = 0;
-    current_fs[(curr_block * 2) + 1] = 0;
+    set_fat_entry(curr_block, 0);
   }
 }
 
+static void free_blocks(size_t index) {
+  free_chain(uchars_to_int16(&current_fs[index + 0xC]));
+}
+
 static void delete_file_entry(size_t index) {
+  if (entry_valid(index)) {
+    fs_index_remove(current_fs, index);
+  }
   memset(&current_fs[index], 0, 20);
 }
 
@@ -293,37 +533,43 @@ static int delete_file(const char *filename) {
 }
 
 int delete_file_and_update(const char *filename) {
+  fs_begin();
   if (delete_file(filename)) {
-    return update_fs();
-  } else {
-    return 1;
+    remove_pending_check(filename);
   }
+  return fs_commit();
 }
 
 /*
-    Print the number of currently free, used, and bad blocks, and
-    the sequence number of the current filesystem.
+    Rename a file on the console.
 */
-void print_stats(void) {
-  size_t free_count = 0;
-  size_t used_count = 0;
-  size_t bad_count = 0;
-
-  int16_t temp = 0;
-  for (int i = 0; i < 0x2000; i += 2) {
-    temp = uchars_to_int16(&current_fs[i]);
+int rename_file_and_update(const char *old_filename,
+                           const char *new_filename) {
+  if (find_file(new_filename)) {
+    fprintf(stderr, "Error renaming file: '%s' already exists!\n",
+            new_filename);
+    return 0;
+  }
 
-    if (temp == 0)
-      free_count++;
-    else if (temp == -2)
-      bad_count++;
-    else
-      used_count++;
+  fs_begin();
+  int success = rename_file(old_filename, new_filename);
+  struct pending_check *check = find_pending_check(old_filename);
+  if (success && check != NULL) {
+    strcpy(check->filename, new_filename);
   }
+  return fs_commit() && success;
+}
 
+/*
+    Print the number of currently free, used, and bad blocks, and
+    the sequence number of the current filesystem.
+*/
+void print_stats(void) {
   uint32_t seqno = uchars_to_uint32(&current_fs[0x3FF8]);
-  printf("Free: %zu\nUsed: %zu\nBad: %zu\nSequence Number: %d\n", free_count,
-         used_count, bad_count, seqno);
+  printf("Free: %u\nUsed: %u\nBad: %u\nSequence Number: %d\n",
+         (unsigned int)fs_alloc_free_count(),
+         (unsigned int)fs_alloc_used_count(),
+         (unsigned int)fs_alloc_bad_count(), seqno);
 }
 
 /*
@@ -335,21 +581,9 @@ int get_storage_stats(uint32_t *out_free_blocks, uint32_t *out_used_blocks,
   if (current_fs == NULL)
     return 0;
 
-  uint32_t free_count = 0;
-  uint32_t used_count = 0;
-  uint32_t bad_count = 0;
-
-  int16_t temp = 0;
-  for (int i = 0; i < 0x2000; i += 2) {
-    temp = uchars_to_int16(&current_fs[i]);
-
-    if (temp == 0)
-      free_count++;
-    else if (temp == -2)
-      bad_count++;
-    else
-      used_count++;
-  }
+  uint32_t free_count = fs_alloc_free_count();
+  uint32_t used_count = fs_alloc_used_count();
+  uint32_t bad_count = fs_alloc_bad_count();
 
   if (out_free_blocks)
     *out_free_blocks = free_count;
@@ -361,35 +595,54 @@ int get_storage_stats(uint32_t *out_free_blocks, uint32_t *out_used_blocks,
   return 1;
 }
 
+/*
+    Get the FAT entry of a block in the current filesystem:
+    0 if it is free, -2 if it is bad, and otherwise in use.
+*/
+int16_t get_fat_entry(uint32_t block) {
+  if (block >= NUM_BLOCKS) {
+    return 0;
+  }
+  return uchars_to_int16(&current_fs[block * 2]);
+}
+
 /*
     Read a file from the console to a file on the host computer.
 */
+static int write_block_to_file(uint32_t block_num, unsigned char *block,
+                               unsigned char *spare, void *context) {
+  (void)block_num;
+  (void)spare;
+  if (fwrite(block, sizeof(unsigned char), BLOCK_SIZE, context) !=
+      BLOCK_SIZE) {
+    fprintf(stderr, "Error writing the file read from the console!\n");
+    return 0;
+  }
+  return 1;
+}
+
+/*
+    Consecutive blocks in the file's chain are read as one run.
+*/
 static int read_blocks_to_file(size_t entry_index, FILE *file) {
-  int success = 1;
-  unsigned char *block_temp = calloc(BLOCK_SIZE, sizeof(unsigned char));
-  unsigned char *spare_temp = calloc(SPARE_SIZE, sizeof(unsigned char));
-  if (block_temp == NULL || spare_temp == NULL) {
-    fprintf(stderr, "Could not allocate memory to read file from console!\n");
-    success = 0;
-  } else {
-    int16_t next_block = uchars_to_int16(&current_fs[entry_index + 0xC]);
-    while (next_block >= 0) {
-      if (!read_block_spare(block_temp, spare_temp, next_block)) {
-        fprintf(stderr,
-                "Unable to read block %x while reading file from console!\n",
-                next_block);
-        success = 0;
-        break;
-      }
-
-      fwrite(block_temp, sizeof(unsigned char), BLOCK_SIZE, file);
+  int16_t next_block = uchars_to_int16(&current_fs[entry_index + 0xC]);
+  while (next_block >= 0) {
+    int16_t first_block = next_block;
+    uint32_t count = 0;
+    do {
+      ++count;
       next_block = uchars_to_int16(&current_fs[next_block * 2]);
+    } while (next_block == first_block + (int16_t)count);
+
+    if (!read_blocks(first_block, count, 0, write_block_to_file, file)) {
+      fprintf(stderr,
+              "Unable to read blocks %x-%x while reading file from console!\n",
+              first_block, first_block + count - 1);
+      return 0;
     }
   }
 
-  free(block_temp);
-  free(spare_temp);
-  return success;
+  return 1;
 }
 
 int read_file(const char *filename) {
@@ -473,21 +726,38 @@ static uint32_t calculate_file_checksum(FILE *file, size_t size) {
 static int validate_file_write(const char *filename, uint32_t checksum,
                                uint32_t blocks_required) {
   size_t index = find_file(filename);
-  if (index &&
+  if (index && entry_committed(index) &&
       file_checksum_cmp(filename, checksum, blocks_required * BLOCK_SIZE)) {
     fprintf(stderr,
             "Exact file to be written already exists on the console!\n");
     return 0;
   }
 
-  uint32_t extra = index ? get_file_block_count(filename) : 0;
+  uint32_t extra = index ? get_entry_block_count(index) : 0;
   if (blocks_required >= (get_free_block_count() + extra)) {
     fprintf(stderr, "Not enough free blocks to write file!\n");
     return 0;
   }
 
   if (index) {
-    delete_file(filename);
+    // The blocks of a file being replaced are held until the commit, unless
+    // the new file only fits in them.
+    int reuse = blocks_required >= get_free_block_count();
+    if (reuse) {
+      fprintf(stderr,
+              "Warning: the new '%s' only fits in the blocks of the old one, "
+              "which are\nreused before the change is committed. If the "
+              "commit fails, the old file\non the console will be "
+              "damaged.\n",
+              filename);
+      fs_alloc_hold_freed(0);
+    }
+    free_blocks(index);
+    if (reuse) {
+      fs_alloc_hold_freed(1);
+    }
+    delete_file_entry(index);
+    remove_pending_check(filename);
   }
   return 1;
 }
@@ -495,10 +765,10 @@ static int validate_file_write(const char *filename, uint32_t checksum,
 static int write_file_blocks(FILE *file, int16_t *blocks_to_write,
                              uint32_t num_blocks) {
 
-  unsigned char *block = calloc(BLOCK_SIZE, sizeof(unsigned char));
+  unsigned char *block = pool_acquire(BLOCK_SIZE);
   if (block == NULL || file == NULL || blocks_to_write == NULL) {
     fprintf(stderr, "Could not perform file write operation!\n");
-    free(block);
+    pool_release(block);
     return 0;
   }
   unsigned char spare[20] = {0};
@@ -528,7 +798,7 @@ static int write_file_blocks(FILE *file, int16_t *blocks_to_write,
     }
   }
 
-  free(block);
+  pool_release(block);
   return success;
 }
 
@@ -545,15 +815,8 @@ static size_t find_blank_file_entry(void) {
   return result;
 }
 
-static int write_file_entry(const char *filename, int16_t start_block,
-                            uint32_t file_size) {
-  size_t index = find_blank_file_entry();
-  if (index == 0) {
-    fprintf(stderr, "No more files can be written to the console.\nAt least "
-                    "one will have to be deleted to create space.\n");
-    return 0;
-  }
-
+static int write_file_entry(size_t index, const char *filename,
+                            int16_t start_block, uint32_t file_size) {
   if (set_filename(index, filename)) {
     current_fs[index + 0xB] = 1;
     current_fs[index + 0xC] = (start_block & 0xFF00) >> 8;
@@ -562,6 +825,9 @@ static int write_file_entry(const char *filename, int16_t start_block,
     current_fs[index + 0x11] = (file_size & 0x00FF0000) >> 16;
     current_fs[index + 0x12] = (file_size & 0x0000FF00) >> 8;
     current_fs[index + 0x13] = (file_size & 0x000000FF);
+    if (entry_valid(index)) {
+      fs_index_add(current_fs, index);
+    }
     return 1;
   } else {
     fprintf(
@@ -571,20 +837,13 @@ static int write_file_entry(const char *filename, int16_t start_block,
   }
 }
 
+// Returns -1 if there is no free block at or after start_block_num.
 static int16_t find_next_free_block(int16_t start_block_num) {
-  int16_t result = -1;
-  for (int16_t i = (start_block_num * 2); i < 0x2000; i += 2) {
-    int16_t temp = uchars_to_int16(&current_fs[i]);
-    if (temp == 0) {
-      result = i;
-      break;
-    }
-  }
-  return (result / 2);
+  return fs_alloc_next_free((uint32_t)start_block_num);
 }
 
-static void update_fs_links(int16_t *blocks_to_write, int16_t start_block,
-                            uint32_t num_blocks) {
+static int update_fs_links(int16_t *blocks_to_write, int16_t start_block,
+                           uint32_t num_blocks) {
   int16_t current_blk = start_block;
   int16_t next_blk = 0;
   uint32_t blocks_remaining = num_blocks;
@@ -594,8 +853,12 @@ static void update_fs_links(int16_t *blocks_to_write, int16_t start_block,
     blocks_to_write[i] = current_blk;
 
     next_blk = find_next_free_block(current_blk + 1);
-    current_fs[current_blk * 2] = (next_blk & 0xFF00) >> 8;
-    current_fs[current_blk * 2 + 1] = (next_blk & 0x00FF);
+    if (next_blk == -1) {
+      fprintf(stderr, "Ran out of free blocks while allocating the file!\n");
+      set_fat_entry(current_blk, -1);
+      return 0;
+    }
+    set_fat_entry(current_blk, next_blk);
 
     current_blk = next_blk;
     blocks_remaining--;
@@ -603,48 +866,58 @@ static void update_fs_links(int16_t *blocks_to_write, int16_t start_block,
   }
 
   blocks_to_write[i] = current_blk;
-  current_fs[current_blk * 2] = 0xFF;
-  current_fs[current_blk * 2 + 1] = 0xFF;
+  set_fat_entry(current_blk, -1);
+  return 1;
 }
 
-static int write_blocks_to_temp_file(FILE *file, uint32_t blocks_required) {
+/*
+    Files are put in the smallest run of free blocks that holds them all,
+    so that their chains are contiguous. Only if there is no such run are
+    they chained through the first free blocks.
+    The entry is made only once the data has been written, and the blocks
+    are freed again if that fails.
+*/
+static int write_new_file(FILE *file, const char *filename,
+                          uint32_t blocks_required) {
+  size_t entry_index = find_blank_file_entry();
+  if (entry_index == 0) {
+    fprintf(stderr, "No more files can be written to the console.\nAt least "
+                    "one will have to be deleted to create space.\n");
+    return 0;
+  }
 
-  int16_t start_block = find_next_free_block(0x40);
-  if (start_block == -1 || !write_file_entry("temp.tmp", start_block,
-                                             blocks_required * BLOCK_SIZE)) {
+  int16_t start_block = fs_alloc_best_extent(0x40, blocks_required);
+  if (start_block == -1) {
+    start_block = find_next_free_block(0x40);
+  }
+  int16_t *blocks_to_write = calloc(blocks_required, sizeof(int16_t));
+  if (start_block == -1 || blocks_to_write == NULL) {
+    free(blocks_to_write);
     return 0;
   }
 
   int success = 1;
-  int16_t *blocks_to_write = calloc(blocks_required, sizeof(int16_t));
-  if (blocks_to_write == NULL) {
+  if (!update_fs_links(blocks_to_write, start_block, blocks_required)) {
+    success = 0;
+  } else if (!write_file_blocks(file, blocks_to_write, blocks_required)) {
+    fprintf(stderr, "Could not write file data to the console!\n");
+    success = 0;
+  } else if (!write_file_entry(entry_index, filename, start_block,
+                               blocks_required * BLOCK_SIZE)) {
     success = 0;
-  } else {
-    update_fs_links(blocks_to_write, start_block, blocks_required);
-    if (!write_file_blocks(file, blocks_to_write, blocks_required)) {
-      fprintf(stderr, "Could not write file data to the console!\n");
-      success = 0;
-    }
   }
 
+  if (!success) {
+    free_chain(start_block);
+  }
   free(blocks_to_write);
   return success;
 }
 
-static int check_and_cleanup_temp_file(const char *filename, uint32_t checksum,
-                                       uint32_t blocks_required) {
-  if (file_checksum_cmp("temp.tmp", checksum, blocks_required * BLOCK_SIZE)) {
-    if (!rename_file("temp.tmp", filename)) {
-      fprintf(stderr, "Could not rename temp.tmp file!\n");
-      return 0;
-    }
-  } else {
-    fprintf(stderr, "Checksum of file written to the console is incorrect!\n");
-    return 0;
-  }
-  return 1;
-}
-
+/*
+    The file is checked against its checksum when the transaction it is
+    written in is committed; on its own, that is right away.
+*/
 int write_file(const char *filename) {
   FILE *pc_file = NULL;
   if (!open_file(&pc_file, filename, "rb")) {
@@ -654,7 +927,9 @@ int write_file(const char *filename) {
   size_t pc_file_size = get_file_size(pc_file);
   uint32_t pc_file_checksum = calculate_file_checksum(pc_file, pc_file_size);
   uint32_t blocks_required = bytes_to_blocks(pc_file_size);
+  rewind(pc_file);
 
+  fs_begin();
   int success = 0;
   if (pc_file_size > UINT32_MAX || blocks_required > 0xFB0) {
     fprintf(stderr, "File is too large to be written to the console!\n");
@@ -663,20 +938,17 @@ int write_file(const char *filename) {
   } else if (!validate_file_write(filename, pc_file_checksum,
                                   blocks_required)) {
     fprintf(stderr, "File write operation aborted.\n");
-  } else if (!write_blocks_to_temp_file(pc_file, blocks_required)) {
+  } else if (!write_new_file(pc_file, filename, blocks_required)) {
     fprintf(stderr, "Error writing file to the console!\n");
-  } else if (!check_and_cleanup_temp_file(filename, pc_file_checksum,
-                                          blocks_required)) {
-    fprintf(
-        stderr,
-        "Error verifying or cleaning up 'temp.tmp' file after file write!\n");
   } else {
+    add_pending_check(filename, pc_file_checksum,
+                      blocks_required * BLOCK_SIZE);
     success = 1;
   }
 
-  // update FS even if a write errors, because it should be as up-to-date as
+  // commit even if a write errors, because the FS should be as up-to-date as
   // possible
-  update_fs();
+  success = fs_commit() && success;
 
   fclose(pc_file);
   return success;
@@ -27,6 +27,8 @@
 #define NUM_FILE_ENTRIES 409
 
 int get_current_fs(void);
+// Uses the FS block cached for the console with this BBID if it is current
+int get_current_fs_cached(uint32_t bbid);
 int dump_current_fs(void);
 int read_file(const char *filename);
 int write_file(const char *filename);
@@ -34,6 +36,21 @@ int list_file_blocks(const char *filename);
 void list_files(void);
 void print_stats(void);
 int delete_file_and_update(const char *filename);
+int rename_file_and_update(const char *old_filename,
+                           const char *new_filename);
+
+/*
+    Changes made between fs_begin and fs_commit are only staged in memory;
+    fs_commit writes them to the console in a single filesystem update.
+    Transactions nest, and only the outermost fs_commit writes. Outside of
+    one, write_file, delete_file_and_update and rename_file_and_update each
+    commit their own change.
+*/
+void fs_begin(void);
+int fs_commit(void);
+// Discards all changes staged since the outermost fs_begin
+void fs_abort(void);
+int fs_in_transaction(void);
 
 // Get storage statistics (for GUI)
 // Returns 1 on success, 0 on failure
@@ -41,4 +58,7 @@ int delete_file_and_update(const char *filename);
 int get_storage_stats(uint32_t *out_free_blocks, uint32_t *out_used_blocks,
                       uint32_t *out_bad_blocks);
 
+// FAT entry of a block in the current filesystem (0 = free, -2 = bad)
+int16_t get_fat_entry(uint32_t block);
+
 #endif
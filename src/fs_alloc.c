@@ -0,0 +1,181 @@
+/*
+    fs_alloc.c
+    free block bitmap of the current filesystem
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "commands.h"
+#include "fs_alloc.h"
+#include "io.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define WORD_BITS 32
+#define BITMAP_WORDS (NUM_BLOCKS / WORD_BITS)
+
+// A set bit marks a free block.
+static uint32_t free_map[BITMAP_WORDS];
+static uint32_t counts[3]; // free, used, bad
+// Blocks freed while holding, which are left out of free_map until released
+static uint32_t held_map[BITMAP_WORDS];
+static uint32_t held_count = 0;
+static int holding = 0;
+
+enum { FREE_BLOCKS = 0, USED_BLOCKS = 1, BAD_BLOCKS = 2 };
+
+static uint32_t find_block(uint32_t start_block, int free);
+static unsigned int lowest_set_bit(uint32_t word);
+
+static int entry_kind(int16_t entry) {
+  if (entry == 0) {
+    return FREE_BLOCKS;
+  }
+  return (entry == -2) ? BAD_BLOCKS : USED_BLOCKS;
+}
+
+void fs_alloc_build(const unsigned char *fat) {
+  memset(free_map, 0, sizeof(free_map));
+  memset(counts, 0, sizeof(counts));
+  memset(held_map, 0, sizeof(held_map));
+  held_count = 0;
+  holding = 0;
+  for (uint32_t block = 0; block < NUM_BLOCKS; ++block) {
+    int kind = entry_kind(uchars_to_int16((unsigned char *)&fat[block * 2]));
+    counts[kind]++;
+    if (kind == FREE_BLOCKS) {
+      free_map[block / WORD_BITS] |= 1u << (block % WORD_BITS);
+    }
+  }
+}
+
+void fs_alloc_update(uint32_t block, int16_t old_entry, int16_t new_entry) {
+  if (block >= NUM_BLOCKS) {
+    return;
+  }
+  counts[entry_kind(old_entry)]--;
+  counts[entry_kind(new_entry)]++;
+  uint32_t bit = 1u << (block % WORD_BITS);
+  if (held_map[block / WORD_BITS] & bit) {
+    held_map[block / WORD_BITS] &= ~bit;
+    held_count--;
+  }
+  if (new_entry == 0 && holding) {
+    held_map[block / WORD_BITS] |= bit;
+    held_count++;
+  } else if (new_entry == 0) {
+    free_map[block / WORD_BITS] |= bit;
+  } else {
+    free_map[block / WORD_BITS] &= ~bit;
+  }
+}
+
+void fs_alloc_hold_freed(int hold) { holding = hold; }
+
+void fs_alloc_release_held(void) {
+  for (uint32_t word = 0; word < BITMAP_WORDS; ++word) {
+    free_map[word] |= held_map[word];
+  }
+  memset(held_map, 0, sizeof(held_map));
+  held_count = 0;
+}
+
+int16_t fs_alloc_next_free(uint32_t start_block) {
+  uint32_t block = find_block(start_block, 1);
+  return (block < NUM_BLOCKS) ? (int16_t)block : -1;
+}
+
+/*
+    The free blocks form runs between blocks in use. Of the runs that
+    start at or after start_block, take the shortest one that is long
+    enough, so that long runs are kept for large files.
+*/
+int16_t fs_alloc_best_extent(uint32_t start_block, uint32_t length) {
+  int16_t best_start = -1;
+  uint32_t best_length = 0;
+  uint32_t block = start_block;
+  while (length != 0 && block < NUM_BLOCKS) {
+    uint32_t run_start = find_block(block, 1);
+    if (run_start >= NUM_BLOCKS) {
+      break;
+    }
+    uint32_t run_end = find_block(run_start, 0);
+    uint32_t run_length = run_end - run_start;
+    if (run_length >= length &&
+        (best_start == -1 || run_length < best_length)) {
+      best_start = (int16_t)run_start;
+      best_length = run_length;
+      if (run_length == length) {
+        break;
+      }
+    }
+    block = run_end;
+  }
+  return best_start;
+}
+
+// Held blocks count as used until they are released.
+uint32_t fs_alloc_free_count(void) { return counts[FREE_BLOCKS] - held_count; }
+
+uint32_t fs_alloc_used_count(void) { return counts[USED_BLOCKS] + held_count; }
+
+uint32_t fs_alloc_bad_count(void) { return counts[BAD_BLOCKS]; }
+
+/*
+    The first block at or after start_block that is free (or, without
+    free, that is not), or NUM_BLOCKS if there is none.
+*/
+static uint32_t find_block(uint32_t start_block, int free) {
+  if (start_block >= NUM_BLOCKS) {
+    return NUM_BLOCKS;
+  }
+  uint32_t invert = free ? 0u : ~0u;
+  uint32_t word = start_block / WORD_BITS;
+  // Ignore the blocks before start_block in its word.
+  uint32_t bits =
+      (free_map[word] ^ invert) & (~0u << (start_block % WORD_BITS));
+  while (bits == 0) {
+    if (++word == BITMAP_WORDS) {
+      return NUM_BLOCKS;
+    }
+    bits = free_map[word] ^ invert;
+  }
+  return word * WORD_BITS + lowest_set_bit(bits);
+}
+
+// word must not be 0.
+static unsigned int lowest_set_bit(uint32_t word) {
+#if defined(__GNUC__)
+  return (unsigned int)__builtin_ctz(word);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, word);
+  return (unsigned int)index;
+#else
+  unsigned int index = 0;
+  while ((word & 1u) == 0) {
+    word >>= 1;
+    ++index;
+  }
+  return index;
+#endif
+}
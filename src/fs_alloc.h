@@ -0,0 +1,53 @@
+/*
+    fs_alloc.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_FS_ALLOC_H
+#define AULON_FS_ALLOC_H
+
+#include <stdint.h>
+
+/*
+    Which blocks the FAT of the current filesystem has free, kept as a
+    bitmap, along with the number of free, used and bad blocks. It is built
+    from the FAT when the filesystem is loaded, and told about every change
+    to a FAT entry after that.
+*/
+void fs_alloc_build(const unsigned char * fat);
+void fs_alloc_update(uint32_t block, int16_t old_entry, int16_t new_entry);
+
+/*
+    While hold is set, blocks that are freed are not handed out again (nor
+    counted as free) until fs_alloc_release_held is called. This keeps the
+    blocks of files deleted in a transaction intact until the console has
+    the filesystem that no longer uses them.
+*/
+void fs_alloc_hold_freed(int hold);
+void fs_alloc_release_held(void);
+
+// The first free block at or after start_block, or -1 if there is none
+int16_t fs_alloc_next_free(uint32_t start_block);
+// The start of the smallest run of at least length free blocks at or after
+// start_block, or -1 if there is none
+int16_t fs_alloc_best_extent(uint32_t start_block, uint32_t length);
+
+uint32_t fs_alloc_free_count(void);
+uint32_t fs_alloc_used_count(void);
+uint32_t fs_alloc_bad_count(void);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+    fs_cache.c
+    cache of each console's current filesystem block
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "commands.h"
+#include "fs_cache.h"
+#include "io.h"
+
+#ifdef GUI_BUILD
+#include "gui_redirect.h"
+#endif
+
+/*
+    File format (all numbers big-endian):
+        header: "AULF", version (u32), BBID (u32), FS block index (u32),
+                hash of the FS block (u64)
+        the FS block (0x4000 bytes)
+*/
+#define CACHE_VERSION 1
+#define CACHE_HEADER_SIZE 24
+
+static const unsigned char CACHE_MAGIC[4] = {'A', 'U', 'L', 'F'};
+
+static void cache_path(char *path, uint32_t bbid);
+
+int fs_cache_load(uint32_t bbid, unsigned char *fs_block, uint32_t *index) {
+  char path[32];
+  cache_path(path, bbid);
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return 0;
+  }
+
+  unsigned char header[CACHE_HEADER_SIZE];
+  int success =
+      fread(header, 1, CACHE_HEADER_SIZE, file) == CACHE_HEADER_SIZE &&
+      memcmp(header, CACHE_MAGIC, 4) == 0 &&
+      uchars_to_uint32(header + 4) == CACHE_VERSION &&
+      uchars_to_uint32(header + 8) == bbid &&
+      uchars_to_uint32(header + 12) < 16 &&
+      fread(fs_block, 1, BLOCK_SIZE, file) == BLOCK_SIZE;
+  if (success) {
+    uint64_t hash = ((uint64_t)uchars_to_uint32(header + 16) << 32) |
+                    uchars_to_uint32(header + 20);
+    success = (fnv1a_64(fs_block, BLOCK_SIZE, FNV1A_64_INIT) == hash);
+    *index = uchars_to_uint32(header + 12);
+  }
+  fclose(file);
+  return success;
+}
+
+int fs_cache_store(uint32_t bbid, const unsigned char *fs_block,
+                   uint32_t index) {
+  char path[32];
+  cache_path(path, bbid);
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    return 0;
+  }
+
+  unsigned char header[CACHE_HEADER_SIZE];
+  uint64_t hash = fnv1a_64(fs_block, BLOCK_SIZE, FNV1A_64_INIT);
+  memcpy(header, CACHE_MAGIC, 4);
+  uint32_to_uchars(header + 4, CACHE_VERSION);
+  uint32_to_uchars(header + 8, bbid);
+  uint32_to_uchars(header + 12, index);
+  uint32_to_uchars(header + 16, (uint32_t)(hash >> 32));
+  uint32_to_uchars(header + 20, (uint32_t)hash);
+  int success =
+      fwrite(header, 1, CACHE_HEADER_SIZE, file) == CACHE_HEADER_SIZE &&
+      fwrite(fs_block, 1, BLOCK_SIZE, file) == BLOCK_SIZE;
+  if (fclose(file) != 0 || !success) {
+    // Do not leave a partial cache behind.
+    remove(path);
+    return 0;
+  }
+  return 1;
+}
+
+static void cache_path(char *path, uint32_t bbid) {
+  sprintf(path, "fs_%08X.cache", (unsigned int)bbid);
+}
@@ -0,0 +1,36 @@
+/*
+    fs_cache.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_FS_CACHE_H
+#define AULON_FS_CACHE_H
+
+#include <stdint.h>
+
+/*
+    The current filesystem block of each console aulon has connected to,
+    with its index among the 16 FS blocks, kept in the working directory
+    in 'fs_[BBID].cache'. It is only a hint: the block must still be
+    checked against the console before it is used.
+    Both functions return 1 for success and 0 for failure.
+*/
+int fs_cache_load(uint32_t bbid, unsigned char * fs_block, uint32_t * index);
+int fs_cache_store(uint32_t bbid, const unsigned char * fs_block,
+                   uint32_t index);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+    fs_index.c
+    hash index of the file entries of the filesystem by name
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fs.h"
+#include "fs_index.h"
+#include "io.h"
+
+#define PACKED_NAME_LENGTH 11
+/*
+    Open addressing with linear probing. Slots hold an entry number plus
+    one; removed entries leave a tombstone, and the table is rebuilt when
+    live entries and tombstones fill three quarters of it.
+*/
+#define INDEX_SLOTS 1024 // A power of two, over twice NUM_FILE_ENTRIES
+#define SLOT_EMPTY 0
+#define SLOT_REMOVED 0xFFFF
+
+static uint16_t slots[INDEX_SLOTS];
+static unsigned int used_slots = 0;
+
+static int pack_filename(const char *filename, unsigned char *packed);
+static void pack_entry_name(const unsigned char *fs_block, size_t entry,
+                            unsigned char *packed);
+static size_t name_slot(const unsigned char *packed);
+static void insert(const unsigned char *fs_block, uint16_t entry_number);
+static void rebuild(const unsigned char *fs_block);
+
+static size_t entry_offset(uint16_t entry_number) {
+  return FILE_ENTRIES_START + (size_t)entry_number * FILE_ENTRY_SIZE;
+}
+
+static uint16_t entry_number(size_t entry) {
+  return (uint16_t)((entry - FILE_ENTRIES_START) / FILE_ENTRY_SIZE);
+}
+
+void fs_index_clear(void) {
+  memset(slots, 0, sizeof(slots));
+  used_slots = 0;
+}
+
+void fs_index_add(const unsigned char *fs_block, size_t entry) {
+  if ((used_slots + 1) * 4 > INDEX_SLOTS * 3) {
+    rebuild(fs_block);
+  }
+  insert(fs_block, entry_number(entry));
+}
+
+void fs_index_remove(const unsigned char *fs_block, size_t entry) {
+  unsigned char packed[PACKED_NAME_LENGTH];
+  pack_entry_name(fs_block, entry, packed);
+  uint16_t value = entry_number(entry) + 1;
+  for (size_t slot = name_slot(packed); slots[slot] != SLOT_EMPTY;
+       slot = (slot + 1) & (INDEX_SLOTS - 1)) {
+    if (slots[slot] == value) {
+      slots[slot] = SLOT_REMOVED;
+      return;
+    }
+  }
+}
+
+size_t fs_index_find(const unsigned char *fs_block, const char *filename) {
+  unsigned char packed[PACKED_NAME_LENGTH];
+  if (!pack_filename(filename, packed)) {
+    return 0;
+  }
+
+  // Duplicate names are possible; the first entry wins, as on the console.
+  uint16_t found = SLOT_REMOVED;
+  for (size_t slot = name_slot(packed); slots[slot] != SLOT_EMPTY;
+       slot = (slot + 1) & (INDEX_SLOTS - 1)) {
+    uint16_t value = slots[slot];
+    if (value == SLOT_REMOVED || value - 1 >= found) {
+      continue;
+    }
+    unsigned char entry_name[PACKED_NAME_LENGTH];
+    pack_entry_name(fs_block, entry_offset(value - 1), entry_name);
+    if (memcmp(entry_name, packed, PACKED_NAME_LENGTH) == 0) {
+      found = value - 1;
+    }
+  }
+  return (found == SLOT_REMOVED) ? 0 : entry_offset(found);
+}
+
+/*
+    Split "name.ext" the same way set_filename in fs.c does.
+*/
+static int pack_filename(const char *filename, unsigned char *packed) {
+  size_t full_len = strlen(filename);
+  size_t fn_len = strcspn(filename, ".");
+  if (full_len > 12 || fn_len > 8 || fn_len == full_len ||
+      full_len - fn_len - 1 > 3) {
+    return 0;
+  }
+  memset(packed, 0, PACKED_NAME_LENGTH);
+  memcpy(packed, filename, fn_len);
+  memcpy(packed + 8, filename + fn_len + 1, full_len - fn_len - 1);
+  return 1;
+}
+
+/*
+    Names in entries end at the first zero byte of each field, whatever
+    comes after it.
+*/
+static void pack_entry_name(const unsigned char *fs_block, size_t entry,
+                            unsigned char *packed) {
+  const unsigned char *name = &fs_block[entry];
+  memset(packed, 0, PACKED_NAME_LENGTH);
+  for (size_t i = 0; i < 8 && name[i] != 0; ++i) {
+    packed[i] = name[i];
+  }
+  for (size_t i = 8; i < PACKED_NAME_LENGTH && name[i] != 0; ++i) {
+    packed[i] = name[i];
+  }
+}
+
+static size_t name_slot(const unsigned char *packed) {
+  return (size_t)(fnv1a_64(packed, PACKED_NAME_LENGTH, FNV1A_64_INIT) &
+                  (INDEX_SLOTS - 1));
+}
+
+static void insert(const unsigned char *fs_block, uint16_t entry_number) {
+  unsigned char packed[PACKED_NAME_LENGTH];
+  pack_entry_name(fs_block, entry_offset(entry_number), packed);
+  size_t slot = name_slot(packed);
+  while (slots[slot] != SLOT_EMPTY && slots[slot] != SLOT_REMOVED) {
+    slot = (slot + 1) & (INDEX_SLOTS - 1);
+  }
+  if (slots[slot] == SLOT_EMPTY) {
+    ++used_slots;
+  }
+  slots[slot] = entry_number + 1;
+}
+
+static void rebuild(const unsigned char *fs_block) {
+  uint16_t entries[INDEX_SLOTS];
+  size_t count = 0;
+  for (size_t slot = 0; slot < INDEX_SLOTS; ++slot) {
+    if (slots[slot] != SLOT_EMPTY && slots[slot] != SLOT_REMOVED) {
+      entries[count++] = slots[slot] - 1;
+    }
+  }
+  fs_index_clear();
+  for (size_t i = 0; i < count; ++i) {
+    insert(fs_block, entries[i]);
+  }
+}
@@ -0,0 +1,39 @@
+/*
+    fs_index.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_FS_INDEX_H
+#define AULON_FS_INDEX_H
+
+#include <stddef.h>
+
+/*
+    A hash index of the file entries of an FS block by their 8.3 names,
+    kept as the 11 bytes they are stored as (name and extension, padded
+    with zeros). Entries are given by their offset in the FS block, and
+    the caller adds and removes them as they become valid or invalid; an
+    entry must be removed before its name changes.
+*/
+void fs_index_clear(void);
+void fs_index_add(const unsigned char * fs_block, size_t entry);
+void fs_index_remove(const unsigned char * fs_block, size_t entry);
+// Returns the offset of the first entry with the given name, or 0 if
+// there is none.
+size_t fs_index_find(const unsigned char * fs_block, const char * filename);
+
+#endif
@@ -29,7 +29,12 @@ int open_file(FILE ** file, const char * filename, const char * mode);
 size_t get_file_size(FILE * file);
 int file_size_check(FILE * file, size_t expected_size);
 uint32_t uchars_to_uint32(unsigned char * bytes);
+void uint32_to_uchars(unsigned char * bytes, uint32_t value);
 int32_t uchars_to_int32(unsigned char * bytes);
 int16_t uchars_to_int16(unsigned char * bytes);
 
+// FNV-1a (64-bit); pass FNV1A_64_INIT, or a previous result to continue it
+#define FNV1A_64_INIT 0xCBF29CE484222325ULL
+uint64_t fnv1a_64(const unsigned char * data, size_t length, uint64_t hash);
+
 #endif
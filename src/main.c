@@ -23,10 +23,12 @@
 #include <string.h>
 
 
+#include "console_model.h"
 #include "defs.h"
 #include "io.h"
 #include "menu.h"
 #include "server.h"
+#include "usb.h"
 #include "usb_log.h"
 
 static FILE *input_file = NULL;
@@ -58,13 +60,17 @@ static void parse_args(int argc, char *argv[]) {
           i++;
         }
       }
-    }
-#if defined(AULON_LOGGING_ENABLED) && (AULON_LOGGING_ENABLED == 1)
-    else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
       usb_log_set_path(argv[i + 1]);
       i++;
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      usb_log_set_pcap_path(argv[i + 1]);
+      i++;
+    } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      console_model_set_image(argv[i + 1]);
+      usb_set_transport(console_model_transport());
+      i++;
     }
-#endif
   }
 }
 
@@ -27,16 +27,17 @@
 #include "io.h"
 #include "menu.h"
 #include "menu_func.h"
+#include "usb_log.h"
 
 #define INPUT_BUFFER_LENGTH                                                    \
   64 // #define because this is used as the declared length of an array
 static const char *const version = AULON_VERSION;
 static const char *const writing = AULON_WRITING_ENABLED ? " (writing)" : "";
-static const char *const logging = AULON_LOGGING_ENABLED ? " (logging)" : "";
 
 void menu_loop(FILE *instream) {
   char *prompt = (instream == stdin ? "> " : "\n");
-  printf("aulon v%s%s%s\n", version, writing, logging);
+  printf("aulon v%s%s%s\n", version, writing,
+         usb_log_requested() ? " (logging)" : "");
   printf("%s", prompt);
 
   char line[INPUT_BUFFER_LENGTH] = {0};
@@ -58,6 +59,10 @@ static void display_help(void) {
          "'current_fs.bin'\n");
   printf("    1             - Dump the console's NAND to 'nand.bin' and "
          "'spare.bin'\n");
+  printf("    5             - Dump only the blocks in use to "
+         "'nand.sparse'\n");
+  printf("    6             - Expand 'nand.sparse' to 'nand.bin' and "
+         "'spare.bin'\n");
   printf("    X blk_num     - Read one block and its spare data from the "
          "console to files\n");
 #if defined(AULON_WRITING_ENABLED) && (AULON_WRITING_ENABLED == 1)
@@ -65,15 +70,23 @@ static void display_help(void) {
          "SKSA)\n");
   printf("    W             - Write full NAND to the console from files "
          "(UNSAFE)\n");
+  printf("    D [full]      - Write only the blocks that differ from the "
+         "console (full: include SKSA)\n");
   printf("    Y blk_num     - Write one block to the console from "
          "'block_[blk_num].bin'\n");
 #endif
   printf("    3 file        - Read [file] from the console\n");
 #if defined(AULON_WRITING_ENABLED) && (AULON_WRITING_ENABLED == 1)
-//  printf("    4 file        - Write [file] to the console\n");
-//  printf("    R file        - Delete [file] from the console\n");
+  printf("    4 file        - Write [file] to the console\n");
+  printf("    R file        - Delete [file] from the console\n");
+  printf("    N old new     - Rename file [old] on the console to [new]\n");
+  printf("    T [action]    - Start a batch of file changes (commit: write "
+         "it, abort: drop it)\n");
 #endif
   printf("    C             - Print statistics about the console's NAND\n");
+  printf("    U             - Print USB transfer statistics\n");
+  printf("    P [name=val]  - Print or change the block command retry "
+         "policy\n");
   printf("    Q             - Close USB connection to the console\n");
   printf("\n");
   printf("    h             - Print this help (but of course you already know "
@@ -84,7 +97,8 @@ static void display_help(void) {
 }
 
 static void display_info(void) {
-  printf("\naulon v%s%s%s\n", version, writing, logging);
+  printf("\naulon v%s%s%s\n", version, writing,
+         usb_log_requested() ? " (logging)" : "");
   printf("Copyright (c) 2018,2019,2020 Jbop (https://github.com/jbop1626)\n");
   printf("aulon is licensed under the GPL v3 (or any later version).\n\n");
   printf("Portions Copyright (c) 2012-2018 Mike Ryan\nOriginally released "
@@ -119,12 +133,24 @@ int execute_command(char *input_line) {
   case '2':
     printf("WriteNand (partial) returns %d\n", WriteNand(FILE_START));
     break;
+  case 'D':
+    printf("WriteNandDelta returns %d\n", WriteNandDelta(input_line));
+    break;
   case 'Y':
     printf("WriteSingleBlock returns %d\n", WriteSingleBlock(input_line));
     break;
-//  case '4':   printf("WriteFile returns %u\n", AulonWriteFile(input_line));
-//  break; case 'R':   printf("DeleteFile returns %u\n",
-//  AulonDeleteFile(input_line));                      break;
+  case '4':
+    printf("WriteFile returns %u\n", AulonWriteFile(input_line));
+    break;
+  case 'R':
+    printf("DeleteFile returns %u\n", AulonDeleteFile(input_line));
+    break;
+  case 'N':
+    printf("RenameFile returns %u\n", AulonRenameFile(input_line));
+    break;
+  case 'T':
+    printf("FileBatch returns %u\n", FileBatch(input_line));
+    break;
 #endif
   case 'B':
     printf("Init returns %u\n", Init());
@@ -153,6 +179,12 @@ int execute_command(char *input_line) {
   case '1':
     printf("DumpNand returns %u\n", DumpNand());
     break;
+  case '5':
+    printf("DumpNandSparse returns %u\n", DumpNandSparse());
+    break;
+  case '6':
+    printf("ExpandSparseDump returns %u\n", ExpandSparseDump());
+    break;
   case 'X':
     printf("ReadSingleBlock returns %d\n", ReadSingleBlock(input_line));
     break;
@@ -162,6 +194,12 @@ int execute_command(char *input_line) {
   case 'C':
     printf("PrintStats returns %u\n", PrintStats());
     break;
+  case 'U':
+    printf("PrintUsbStats returns %u\n", PrintUsbStats());
+    break;
+  case 'P':
+    printf("SetRetryPolicy returns %d\n", SetRetryPolicy(input_line));
+    break;
   case 'Q':
     printf("Close returns %u\n", Close());
     break;
@@ -27,22 +27,42 @@
 #include <time.h>
 
 #include "commands.h"
+#include "dump_journal.h"
 #include "fs.h"
 #include "io.h"
 #include "menu_func.h"
+#include "nand_manifest.h"
 #include "player_comms.h"
+#include "pool.h"
+#include "retry.h"
+#include "sparse.h"
 #include "usb.h"
+#include "usb_stats.h"
 
 #ifdef GUI_BUILD
 #include "gui_redirect.h"
 #endif
 
-static int dump_nand_and_spare_to_files(FILE *nand_file, FILE *spare_file);
-
+static int open_dump_files(uint32_t bbid, FILE **nand_file, FILE **spare_file,
+                           uint32_t *verified);
+static int dump_nand_and_spare_to_files(FILE *nand_file, FILE *spare_file,
+                                        uint32_t verified);
+static int dump_block_to_files(uint32_t blk_no, unsigned char *block_buffer,
+                               unsigned char *spare_buffer, void *context);
+static uint32_t build_sparse_map(unsigned char *map, uint32_t *free_count,
+                                 uint32_t *bad_count);
+static int dump_sparse_blocks(FILE *sparse_file, const unsigned char *map,
+                              uint32_t present);
+static int dump_block_to_sparse(uint32_t blk_no, unsigned char *block_buffer,
+                                unsigned char *spare_buffer, void *context);
+
+static int write_nand(int block_start, int delta);
 static int get_unsafe_write_confirmation(void);
 static int open_and_check_files(FILE **nand_file, FILE **spare_file);
 static int write_nand_and_spare_to_player(FILE **nand_file, FILE **spare_file,
-                                          int block_start);
+                                          int block_start, int delta);
+static int block_on_console(unsigned char *block_buffer,
+                            unsigned char *spare_buffer, uint32_t block_num);
 static int reading_files_failed(FILE *nand_file, unsigned char *block_buffer,
                                 FILE *spare_file, unsigned char *spare_buffer);
 
@@ -55,6 +75,9 @@ static void print_hash_and_sig(unsigned char *hash, unsigned char *sig);
 
 static int prepare_time_data(uint32_t *first_half, unsigned char *second_half);
 
+static int set_retry_setting(struct retry_policy *policy, const char *setting);
+static void print_retry_policy(const struct retry_policy *policy);
+
 int Init(void) {
   if (usb_handle_exists()) {
     fprintf(stderr, "A device is already connected.\nCall Close (Q) to "
@@ -63,13 +86,22 @@ int Init(void) {
   }
 
   int success = 1;
+  uint32_t bbid = 0;
+  if (!pool_init()) {
+    return 0;
+  }
+  ique_reset_protocol();
+  nand_manifest_reset();
+  retry_reset_session();
   if (!usb_init_connection()) {
     success = 0;
   } else if (!set_seqno(0x0001)) {
     success = 0;
   } else if (!get_num_blocks()) {
     success = 0;
-  } else if (!get_current_fs()) {
+  } else if (!get_bbid(&bbid)) {
+    success = 0;
+  } else if (!get_current_fs_cached(bbid)) {
     success = 0;
   } else if (!init_fs()) {
     success = 0;
@@ -81,6 +113,7 @@ int Init(void) {
     printf("Connection to the device was initialized successfully.\n");
   } else {
     usb_close_connection();
+    pool_free();
     fprintf(stderr, "Failed to establish a USB connection to the device.\n");
   }
 
@@ -245,50 +278,245 @@ int DumpNand(void) {
     return 0;
   }
 
-  FILE *nand_file = NULL;
-  FILE *spare_file = NULL;
-  if (!open_file(&spare_file, "spare.bin", "wb")) {
-    return 0;
-  }
-  if (!open_file(&nand_file, "nand.bin", "wb")) {
-    fclose(spare_file);
+  uint32_t bbid = 0;
+  if (!get_bbid(&bbid)) {
     return 0;
   }
-  if (!dump_nand_and_spare_to_files(nand_file, spare_file)) {
-    fclose(nand_file);
-    fclose(spare_file);
+
+  FILE *nand_file = NULL;
+  FILE *spare_file = NULL;
+  uint32_t verified = 0;
+  if (!open_dump_files(bbid, &nand_file, &spare_file, &verified)) {
     return 0;
   }
+  int success = dump_nand_and_spare_to_files(nand_file, spare_file, verified);
 
   fclose(nand_file);
   fclose(spare_file);
+  dump_journal_close(success);
+  if (!success) {
+    fprintf(stderr, "Run the dump again to resume it.\n");
+    return 0;
+  }
   printf("\nNAND dump complete!\n");
   return 1;
 }
 
-static int dump_nand_and_spare_to_files(FILE *nand_file, FILE *spare_file) {
-  unsigned char block_buffer[BLOCK_SIZE] = {0};
-  unsigned char spare_buffer[SPARE_SIZE] = {0};
+/*
+    An earlier dump of the same console that did not finish is resumed:
+    the files are kept, and the blocks the journal shows to be intact in
+    them are not read again. Otherwise the files are started over.
+*/
+static int open_dump_files(uint32_t bbid, FILE **nand_file, FILE **spare_file,
+                           uint32_t *verified) {
+  int resume = dump_journal_resumable(DUMP_JOURNAL_FILENAME, bbid) &&
+               (*nand_file = fopen("nand.bin", "r+b")) != NULL &&
+               (*spare_file = fopen("spare.bin", "r+b")) != NULL;
+  if (!resume) {
+    if (*nand_file) {
+      fclose(*nand_file);
+      *nand_file = NULL;
+    }
+    if (!open_file(spare_file, "spare.bin", "w+b")) {
+      return 0;
+    }
+    if (!open_file(nand_file, "nand.bin", "w+b")) {
+      fclose(*spare_file);
+      return 0;
+    }
+  }
+
+  if (!dump_journal_open(DUMP_JOURNAL_FILENAME, bbid,
+                         resume ? *nand_file : NULL,
+                         resume ? *spare_file : NULL, verified)) {
+    fclose(*nand_file);
+    fclose(*spare_file);
+    return 0;
+  }
+  if (resume) {
+    printf("Resuming the NAND dump; %u blocks were already read.\n",
+           (unsigned int)*verified);
+  }
+  return 1;
+}
+
+struct dump_progress {
+  FILE *nand_file;
+  FILE *spare_file;
+  uint32_t done;
+  uint32_t total;
+};
+
+/*
+    Blocks are read in runs of consecutive blocks that still need reading.
+*/
+static int dump_nand_and_spare_to_files(FILE *nand_file, FILE *spare_file,
+                                        uint32_t verified) {
+  struct dump_progress progress = {nand_file, spare_file, verified,
+                                   NUM_BLOCKS};
 
   printf("Reading NAND and spare blocks from the console...\n");
-  printf("Blocks read: %.4d (%.2f%%).", 0, 0.0);
-  int blk_no;
-  for (blk_no = 0; blk_no < NUM_BLOCKS; ++blk_no) {
-    if (read_block_spare(block_buffer, spare_buffer, blk_no)) {
-      fwrite(block_buffer, sizeof(block_buffer[0]), BLOCK_SIZE, nand_file);
-      fwrite(spare_buffer, sizeof(spare_buffer[0]), SPARE_SIZE, spare_file);
-      fflush(nand_file);
-      fflush(spare_file);
-      printf("\rBlocks read: %.4d (%.2f%%).", blk_no + 1,
-             ((blk_no + 1) / 4096.0) * 100.0);
-      fflush(stdout);
+  printf("Blocks read: %.4u (%.2f%%).", (unsigned int)progress.done,
+         (progress.done / 4096.0) * 100.0);
+  uint32_t blk_no = 0;
+  while (blk_no < NUM_BLOCKS) {
+    if (dump_journal_block_verified(blk_no)) {
+      ++blk_no;
+      continue;
+    }
+    uint32_t count = 1;
+    while (blk_no + count < NUM_BLOCKS &&
+           !dump_journal_block_verified(blk_no + count)) {
+      ++count;
+    }
+    if (!read_blocks_spare(blk_no, count, dump_block_to_files, &progress)) {
+      fprintf(stderr,
+              "Error reading block while dumping NAND from the console.\n");
+      return 0;
+    }
+    blk_no += count;
+  }
+
+  return 1;
+}
+
+static int dump_block_to_files(uint32_t blk_no, unsigned char *block_buffer,
+                               unsigned char *spare_buffer, void *context) {
+  struct dump_progress *progress = context;
+  if (fseek(progress->nand_file, (long)blk_no * BLOCK_SIZE, SEEK_SET) != 0 ||
+      fseek(progress->spare_file, (long)blk_no * SPARE_SIZE, SEEK_SET) != 0 ||
+      fwrite(block_buffer, sizeof(block_buffer[0]), BLOCK_SIZE,
+             progress->nand_file) != BLOCK_SIZE ||
+      fwrite(spare_buffer, sizeof(spare_buffer[0]), SPARE_SIZE,
+             progress->spare_file) != SPARE_SIZE ||
+      fflush(progress->nand_file) != 0 || fflush(progress->spare_file) != 0 ||
+      !dump_journal_record(blk_no, block_buffer, spare_buffer)) {
+    fprintf(stderr, "Error writing block 0x%04x to the dump files.\n",
+            (unsigned int)blk_no);
+    return 0;
+  }
+  ++progress->done;
+  printf("\rBlocks read: %.4u (%.2f%%).", (unsigned int)progress->done,
+         (progress->done / 4096.0) * 100.0);
+  fflush(stdout);
+  return 1;
+}
+
+/*
+    Dump only the blocks that hold data: the SKSA area, the filesystem
+    blocks, and the blocks the current FAT has allocated. Free and bad
+    blocks are recorded as skipped in the sparse image, which can be
+    expanded to nand.bin and spare.bin later.
+*/
+int DumpNandSparse(void) {
+  if (!usb_handle_exists()) {
+    fprintf(stderr, "Device handle does not exist. Did you call Init (B)?\n");
+    return 0;
+  }
+  // The map is built from the console's FAT, which a batch has not
+  // changed yet, and reading that FAT would drop the batch.
+  if (fs_in_transaction()) {
+    fprintf(stderr, "A batch of file changes is open. Commit it with "
+                    "'T commit' or discard it with 'T abort' first.\n");
+    return 0;
+  }
+  // The FAT read at Init may be out of date.
+  if (!get_current_fs()) {
+    fprintf(stderr, "Could not read the console's filesystem.\n");
+    return 0;
+  }
+
+  static unsigned char map[NUM_BLOCKS];
+  uint32_t free_count = 0;
+  uint32_t bad_count = 0;
+  uint32_t present = build_sparse_map(map, &free_count, &bad_count);
+
+  FILE *sparse_file = NULL;
+  if (!open_file(&sparse_file, SPARSE_FILENAME, "wb")) {
+    return 0;
+  }
+  int success = sparse_write_header(sparse_file, map) &&
+                dump_sparse_blocks(sparse_file, map, present);
+  if (fclose(sparse_file) != 0) {
+    success = 0;
+  }
+  if (!success) {
+    return 0;
+  }
+  printf("\nSparse NAND dump complete! %u blocks read; %u free and %u bad "
+         "blocks skipped.\n",
+         (unsigned int)present, (unsigned int)free_count,
+         (unsigned int)bad_count);
+  return 1;
+}
+
+static uint32_t build_sparse_map(unsigned char *map, uint32_t *free_count,
+                                 uint32_t *bad_count) {
+  uint32_t present = 0;
+  for (uint32_t i = 0; i < NUM_BLOCKS; ++i) {
+    // The SKSA area and the filesystem blocks (0xFF0 onwards) are always read
+    int16_t entry = (i < FILE_START || i >= 0xFF0) ? -1 : get_fat_entry(i);
+    if (entry == 0) {
+      map[i] = SPARSE_FREE;
+      ++*free_count;
+    } else if (entry == -2) {
+      map[i] = SPARSE_BAD;
+      ++*bad_count;
     } else {
+      map[i] = SPARSE_PRESENT;
+      ++present;
+    }
+  }
+  return present;
+}
+
+static int dump_sparse_blocks(FILE *sparse_file, const unsigned char *map,
+                              uint32_t present) {
+  struct dump_progress progress = {sparse_file, NULL, 0, present};
+
+  printf("Reading %u allocated blocks from the console...\n",
+         (unsigned int)present);
+  uint32_t blk_no = 0;
+  while (blk_no < NUM_BLOCKS) {
+    if (map[blk_no] != SPARSE_PRESENT) {
+      ++blk_no;
+      continue;
+    }
+    uint32_t count = 1;
+    while (blk_no + count < NUM_BLOCKS &&
+           map[blk_no + count] == SPARSE_PRESENT) {
+      ++count;
+    }
+    if (!read_blocks_spare(blk_no, count, dump_block_to_sparse, &progress)) {
       fprintf(stderr,
               "Error reading block while dumping NAND from the console.\n");
       return 0;
     }
+    blk_no += count;
+  }
+  return 1;
+}
+
+static int dump_block_to_sparse(uint32_t blk_no, unsigned char *block_buffer,
+                                unsigned char *spare_buffer, void *context) {
+  struct dump_progress *progress = context;
+  (void)blk_no;
+  if (!sparse_write_block(progress->nand_file, block_buffer, spare_buffer)) {
+    return 0;
   }
+  ++progress->done;
+  printf("\rBlocks read: %.4u of %.4u (%.2f%%).", (unsigned int)progress->done,
+         (unsigned int)progress->total,
+         (progress->done * 100.0) / progress->total);
+  fflush(stdout);
+  return 1;
+}
 
+int ExpandSparseDump(void) {
+  if (!sparse_expand(SPARSE_FILENAME, "nand.bin", "spare.bin")) {
+    return 0;
+  }
+  printf("Expanded '%s' to 'nand.bin' and 'spare.bin'.\n", SPARSE_FILENAME);
   return 1;
 }
 
@@ -308,14 +536,14 @@ int ReadSingleBlock(char *line) {
   }
 
   int success = 0;
-  unsigned char *block = calloc(BLOCK_SIZE, sizeof(unsigned char));
-  unsigned char *spare = calloc(SPARE_SIZE, sizeof(unsigned char));
+  unsigned char *block = pool_acquire(BLOCK_SIZE);
+  unsigned char *spare = pool_acquire(SPARE_SIZE);
   if (block != NULL && spare != NULL) {
     success = save_single_block(block, spare, (uint32_t)block_num);
   }
 
-  free(block);
-  free(spare);
+  pool_release(block);
+  pool_release(spare);
   return success;
 }
 
@@ -350,7 +578,17 @@ static int save_single_block(unsigned char *block, unsigned char *spare,
   }
 }
 
-int WriteNand(int block_start) {
+int WriteNand(int block_start) { return write_nand(block_start, 0); }
+
+int WriteNandDelta(char *line) {
+  int block_start = FILE_START;
+  if (strlen(line) >= 3 && strcmp(line + 2, "full") == 0) {
+    block_start = NAND_START;
+  }
+  return write_nand(block_start, 1);
+}
+
+static int write_nand(int block_start, int delta) {
   if (!usb_handle_exists()) {
     fprintf(stderr, "Device handle does not exist. Did you call Init (B)?\n");
     return 0;
@@ -371,7 +609,7 @@ int WriteNand(int block_start) {
   if (!open_and_check_files(&nand_file, &spare_file)) {
     success = 0;
   } else if (!write_nand_and_spare_to_player(&nand_file, &spare_file,
-                                             block_start)) {
+                                             block_start, delta)) {
     success = 0;
   }
 
@@ -419,11 +657,17 @@ static int open_and_check_files(FILE **nand_file, FILE **spare_file) {
   return 1;
 }
 
+/*
+    In delta mode, blocks the console already holds are skipped. Whether it
+    does is taken from the NAND manifest if the block was read or written
+    during this connection, and otherwise read from the console.
+*/
 static int write_nand_and_spare_to_player(FILE **nand_file, FILE **spare_file,
-                                          int block_start) {
+                                          int block_start, int delta) {
   unsigned char block_buffer[BLOCK_SIZE] = {0};
   unsigned char spare_buffer[SPARE_SIZE] = {0};
   double limit = NUM_BLOCKS - block_start;
+  int blocks_done = 0;
   int blocks_written = 0;
 
   if (fseek(*nand_file, block_start * BLOCK_SIZE, SEEK_SET) != 0 ||
@@ -442,10 +686,19 @@ static int write_nand_and_spare_to_player(FILE **nand_file, FILE **spare_file,
                       "NAND write.\n");
       return 0;
     }
+    blocks_done = (blk_no + 1) - block_start;
+    if (delta && block_on_console(block_buffer, spare_buffer, blk_no)) {
+      continue;
+    }
     if (write_block_spare(block_buffer, spare_buffer, blk_no)) {
-      blocks_written = (blk_no + 1) - block_start;
-      printf("\rBlocks written: %.4d (%.2f%%).", blocks_written,
-             (blocks_written / limit) * 100.0);
+      ++blocks_written;
+      if (delta) {
+        printf("\rBlocks checked: %.4d (%.2f%%), written: %.4d.",
+               blocks_done, (blocks_done / limit) * 100.0, blocks_written);
+      } else {
+        printf("\rBlocks written: %.4d (%.2f%%).", blocks_written,
+               (blocks_written / limit) * 100.0);
+      }
       fflush(stdout);
     } else {
       fprintf(stderr,
@@ -454,9 +707,32 @@ static int write_nand_and_spare_to_player(FILE **nand_file, FILE **spare_file,
     }
   }
 
+  if (delta) {
+    printf("\rBlocks checked: %.4d (%.2f%%), written: %.4d.", blocks_done,
+           100.0, blocks_written);
+    printf("\n%d of %d blocks differed and were written.", blocks_written,
+           blocks_done);
+  }
   return 1;
 }
 
+// Returns 1 if the console already holds this block and its SA data.
+static int block_on_console(unsigned char *block_buffer,
+                            unsigned char *spare_buffer, uint32_t block_num) {
+  if (spare_buffer[5] != 0xFF) {
+    // Marked bad; write_block_spare would skip it anyway
+    return 1;
+  }
+  if (!nand_manifest_known(block_num)) {
+    static unsigned char console_block[BLOCK_SIZE];
+    unsigned char console_spare[SPARE_SIZE];
+    if (!read_block_spare(console_block, console_spare, block_num)) {
+      return 0;
+    }
+  }
+  return nand_manifest_matches(block_num, block_buffer, spare_buffer);
+}
+
 static int reading_files_failed(FILE *nand_file, unsigned char *block_buffer,
                                 FILE *spare_file, unsigned char *spare_buffer) {
   int read_block_fail = (fread(block_buffer, sizeof(block_buffer[0]),
@@ -482,12 +758,12 @@ int WriteSingleBlock(char *line) {
   }
 
   int success = 0;
-  unsigned char *block = calloc(BLOCK_SIZE, sizeof(unsigned char));
+  unsigned char *block = pool_acquire(BLOCK_SIZE);
   if (block != NULL) {
     success = send_single_block(block, (uint32_t)block_num);
   }
 
-  free(block);
+  pool_release(block);
   return success;
 }
 
@@ -561,6 +837,51 @@ int AulonDeleteFile(char *line) {
   return delete_file_and_update(line + 2);
 }
 
+int AulonRenameFile(char *line) {
+  if (!usb_handle_exists()) {
+    fprintf(stderr, "Device handle does not exist. Did you call Init (B)?\n");
+    return 0;
+  }
+  char *old_filename = strtok(line + 1, " \t\r\n");
+  char *new_filename = strtok(NULL, " \t\r\n");
+  if (old_filename == NULL || new_filename == NULL) {
+    fprintf(stderr, "Usage: N old_file new_file\n");
+    return 0;
+  }
+  return rename_file_and_update(old_filename, new_filename);
+}
+
+int FileBatch(char *line) {
+  if (!usb_handle_exists()) {
+    fprintf(stderr, "Device handle does not exist. Did you call Init (B)?\n");
+    return 0;
+  }
+  char *action = strtok(line + 1, " \t\r\n");
+  if (action == NULL) {
+    if (fs_in_transaction()) {
+      fprintf(stderr, "A batch is already open. Commit it with 'T commit' or "
+                      "discard it with 'T abort'.\n");
+      return 0;
+    }
+    fs_begin();
+    printf("File changes will be staged until 'T commit'.\n");
+    return 1;
+  }
+
+  if (!fs_in_transaction()) {
+    fprintf(stderr, "No batch is open. Start one with 'T'.\n");
+    return 0;
+  } else if (strcmp(action, "commit") == 0) {
+    return fs_commit();
+  } else if (strcmp(action, "abort") == 0) {
+    fs_abort();
+    printf("The staged file changes were discarded.\n");
+    return 1;
+  }
+  fprintf(stderr, "Unknown batch action '%s'.\n", action);
+  return 0;
+}
+
 int PrintStats(void) {
   if (!usb_handle_exists()) {
     fprintf(stderr, "Device handle does not exist. Did you call Init (B)?\n");
@@ -568,18 +889,118 @@ int PrintStats(void) {
   }
 
   print_stats();
+  printf("Transfer buffers: %zu acquired, %zu allocated from the heap.\n",
+         pool_acquire_count(), pool_heap_allocation_count());
+  return 1;
+}
+
+int PrintUsbStats(void) {
+  usb_stats_print(stdout);
   return 1;
 }
 
+/*
+    With no arguments, print the retry policy of the block commands.
+    Otherwise change the settings given as name=value pairs.
+*/
+int SetRetryPolicy(char *line) {
+  struct retry_policy policy;
+  retry_get_policy(&policy);
+
+  int changed = 0;
+  char *setting = strtok(line + 1, " \t\r\n");
+  while (setting != NULL) {
+    if (!set_retry_setting(&policy, setting)) {
+      fprintf(stderr, "Invalid retry setting '%s'.\n", setting);
+      return 0;
+    }
+    changed = 1;
+    setting = strtok(NULL, " \t\r\n");
+  }
+  if (changed && !retry_set_policy(&policy)) {
+    fprintf(stderr, "Invalid retry policy: attempts must be at least 1, "
+                    "jitter at most 100, and max_delay at least delay.\n");
+    return 0;
+  }
+
+  retry_get_policy(&policy);
+  print_retry_policy(&policy);
+  return 1;
+}
+
+static int set_retry_setting(struct retry_policy *policy, const char *setting) {
+  static const char *const class_names[RETRY_ERROR_CLASS_COUNT] = {
+      "rejected", "transfer", "connection"};
+  const char *value = strchr(setting, '=');
+  if (value == NULL || value[1] == '\0') {
+    return 0;
+  }
+  size_t name_length = value - setting;
+  char *end = NULL;
+  unsigned long number = strtoul(value + 1, &end, 0);
+  if (*end != '\0' || number > 0xFFFFFFFFul) {
+    return 0;
+  }
+
+  struct {
+    const char *name;
+    unsigned int *field;
+  } fields[] = {{"attempts", &policy->max_attempts},
+                {"delay", &policy->base_delay_ms},
+                {"max_delay", &policy->max_delay_ms},
+                {"jitter", &policy->jitter_percent},
+                {"budget", &policy->session_budget}};
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+    if (strlen(fields[i].name) == name_length &&
+        strncmp(setting, fields[i].name, name_length) == 0) {
+      *fields[i].field = (unsigned int)number;
+      return 1;
+    }
+  }
+  for (int i = 0; i < RETRY_ERROR_CLASS_COUNT; ++i) {
+    if (strlen(class_names[i]) == name_length &&
+        strncmp(setting, class_names[i], name_length) == 0 && number <= 1) {
+      policy->retry_class[i] = (int)number;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void print_retry_policy(const struct retry_policy *policy) {
+  printf("Block commands are tried up to %u times.\n", policy->max_attempts);
+  printf("Backoff: %u ms, doubling up to %u ms, shortened by up to %u%% "
+         "jitter.\n",
+         policy->base_delay_ms, policy->max_delay_ms, policy->jitter_percent);
+  if (policy->session_budget != 0) {
+    printf("Retry budget: %u of %u retries used in this session.\n",
+           retry_session_count(), policy->session_budget);
+  } else {
+    printf("Retry budget: unlimited (%u retries in this session).\n",
+           retry_session_count());
+  }
+  printf("Retried after: rejections %s, transfer errors %s, connection "
+         "errors %s.\n",
+         policy->retry_class[RETRY_ERROR_REJECTED] ? "yes" : "no",
+         policy->retry_class[RETRY_ERROR_TRANSFER] ? "yes" : "no",
+         policy->retry_class[RETRY_ERROR_CONNECTION] ? "yes" : "no");
+}
+
 int Close(void) {
   if (!usb_handle_exists()) {
     fprintf(stderr, "Device handle does not exist. No connection is open.\n");
     return 0;
   }
+  if (fs_in_transaction()) {
+    fs_abort();
+    fprintf(stderr, "The file changes staged in the open batch were "
+                    "discarded.\n");
+  }
   if (!usb_close_connection()) {
     fprintf(stderr, "Could not close USB connection.\n");
     return 0;
   }
+  pool_free();
   printf("Connection to current device closed.\n");
   return 1;
 }
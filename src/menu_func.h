@@ -35,8 +35,15 @@ int ListFileBlocks(char *line);
 int ListFiles(void);
 int DumpCurrentFS(void);
 int DumpNand(void);
+// Reads only the blocks in use to 'nand.sparse'
+int DumpNandSparse(void);
+// Expands 'nand.sparse' to 'nand.bin' and 'spare.bin'
+int ExpandSparseDump(void);
 int ReadSingleBlock(char *line);
 int WriteNand(int block_start);
+// Writes only the blocks that differ from the console; "D full" includes
+// the SKSA area.
+int WriteNandDelta(char *line);
 int WriteSingleBlock(char *line);
 // AulonReadFile
 // Reads data from the iQue player to a file on the PC
@@ -45,7 +52,16 @@ int AulonReadFile(char *input_line);
 int AulonWriteFile(char *line);
 // AulonDeleteFile
 int AulonDeleteFile(char *line);
+// Renames a file on the console: "N old_file new_file"
+int AulonRenameFile(char *line);
+// "T" starts a batch of file writes, deletes and renames, which are written
+// to the console in one filesystem update by "T commit" ("T abort" drops
+// them).
+int FileBatch(char *line);
 int PrintStats(void);
+int PrintUsbStats(void);
+// Prints the retry policy, or changes it: "P name=value ..."
+int SetRetryPolicy(char *line);
 int Close(void);
 
 #endif
@@ -0,0 +1,67 @@
+/*
+    nand_manifest.c
+    hashes of the blocks known to be on the connected console
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "commands.h"
+#include "io.h"
+#include "nand_manifest.h"
+
+#define SA_SPARE_BYTES 3
+
+static uint64_t hashes[NUM_BLOCKS];
+static unsigned char known[NUM_BLOCKS];
+
+static uint64_t block_hash(const unsigned char *block_data,
+                           const unsigned char *spare_data);
+
+void nand_manifest_reset(void) { memset(known, 0, sizeof(known)); }
+
+void nand_manifest_set(uint32_t block, const unsigned char *block_data,
+                       const unsigned char *spare_data) {
+  if (block < NUM_BLOCKS) {
+    hashes[block] = block_hash(block_data, spare_data);
+    known[block] = 1;
+  }
+}
+
+void nand_manifest_forget(uint32_t block) {
+  if (block < NUM_BLOCKS) {
+    known[block] = 0;
+  }
+}
+
+int nand_manifest_known(uint32_t block) {
+  return (block < NUM_BLOCKS) && known[block];
+}
+
+int nand_manifest_matches(uint32_t block, const unsigned char *block_data,
+                          const unsigned char *spare_data) {
+  return nand_manifest_known(block) &&
+         hashes[block] == block_hash(block_data, spare_data);
+}
+
+static uint64_t block_hash(const unsigned char *block_data,
+                           const unsigned char *spare_data) {
+  uint64_t hash = fnv1a_64(block_data, BLOCK_SIZE, FNV1A_64_INIT);
+  return fnv1a_64(spare_data, SA_SPARE_BYTES, hash);
+}
@@ -0,0 +1,44 @@
+/*
+    nand_manifest.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_NAND_MANIFEST_H
+#define AULON_NAND_MANIFEST_H
+
+#include <stdint.h>
+
+/*
+    What aulon knows about the blocks of the connected console: a hash of
+    each block as last read from or written to it during this connection.
+    The block read and write commands keep it up to date, and it is cleared
+    when a connection is opened, since the console can change its NAND
+    while it is not connected.
+
+    The hash covers the block data and the SA bytes of the spare (the first
+    3); the console fills in the rest of the spare itself.
+*/
+void nand_manifest_reset(void);
+void nand_manifest_set(uint32_t block, const unsigned char * block_data,
+                       const unsigned char * spare_data);
+void nand_manifest_forget(uint32_t block);
+int nand_manifest_known(uint32_t block);
+// Returns 1 if the block is known to hold this data and spare
+int nand_manifest_matches(uint32_t block, const unsigned char * block_data,
+                          const unsigned char * spare_data);
+
+#endif
@@ -30,29 +30,53 @@
 #include <arpa/inet.h>
 #endif
 
+#include "framing.h"
 #include "io.h"
 #include "player_comms.h"
+#include "pool.h"
 #include "usb.h"
+#include "usb_stats.h"
 
 
 #ifdef GUI_BUILD
 #include "gui_redirect.h"
 #endif
 
-#define PACKET_SIZE                                                            \
-  0x80 // #define because this is used as the declared length of an array
 static const unsigned char SEND_CHUNK_SIGNAL = 0x63;
+#define SEND_CHUNK_MAX 0xFE
+// Chunked data is framed into one buffer and sent with a single transfer;
+// the buffer holds one NAND block (0x4000 bytes) with all of its chunk headers.
+#define CHUNKED_DATA_MAX 0x4000
+#define CHUNKED_BUFFER_SIZE                                                    \
+  (CHUNKED_DATA_MAX +                                                          \
+   2 * ((CHUNKED_DATA_MAX + SEND_CHUNK_MAX - 1) / SEND_CHUNK_MAX))
+static unsigned char chunked_buffer[CHUNKED_BUFFER_SIZE];
 static const unsigned char READY_SIGNAL[4] = {0x15, 0, 0, 0};
-
+// A wait for the ready signal gives up after this many reads of 1 s each.
+#define READY_WAIT_ATTEMPTS 5
+static int ready_credit = 0;
+// Holds the largest reply (0x1000 bytes framed into 0x1558) with room to
+// spare for whatever follows it.
+#define IN_BUFFER_SIZE 0x2000
+static unsigned char in_buffer[IN_BUFFER_SIZE];
+static size_t in_start = 0;
+static size_t in_end = 0;
+
+static int send_to_player(unsigned char *data, int length, int *transferred,
+                          unsigned int timeout);
 static int ique_is_ready(void);
+static size_t buffered_input(void);
+static void discard_input(void);
+static int fill_input(size_t expected, unsigned int timeout);
+static int send_piecemeal(unsigned char *data, size_t data_length,
+                          unsigned char *frame_buffer);
 static size_t ique_receive_data_length(void);
+static size_t framed_length(size_t data_length);
 static int ique_receive_data(unsigned char *buffer, size_t data_length);
-static int parse_received_data(unsigned char *in_buffer,
+static int parse_received_data(unsigned char *in_data,
                                size_t total_data_received,
                                unsigned char *out_buffer,
                                size_t expected_data_length);
-static void process_piecemeal_data(unsigned char *input, size_t input_length,
-                                   unsigned char *output);
 
 /*
     SEND data
@@ -75,79 +99,104 @@ static void process_piecemeal_data(unsigned char *input, size_t input_length,
 */
 
 int ique_send_chunked_data(unsigned char *data, size_t data_length) {
-  unsigned char chunk_buffer[0x100] = {SEND_CHUNK_SIGNAL};
   size_t remaining_data = data_length;
-  unsigned int offset = 0;
+  size_t offset = 0;
   int transferred = 0;
+  usb_set_phase(USB_PHASE_DATA);
 
+  // All chunks but the last are 0x100 bytes long, a whole number of USB
+  // packets, so sending them back to back in one transfer produces exactly
+  // the same packets on the bus as sending each chunk on its own.
   while (remaining_data) {
-    unsigned char chunk_length =
-        (remaining_data >= 0xFE) ? 0xFE : (unsigned char)remaining_data;
-    chunk_buffer[1] = chunk_length;
-    memcpy(chunk_buffer + 2, data + offset, chunk_length);
-    if (!usb_bulk_transfer_send(chunk_buffer, chunk_length + 2, &transferred,
-                                1000)) {
-      fprintf(stderr, "Error when sending chunk of data to the player.\n");
+    size_t framed = 0;
+    while (remaining_data) {
+      unsigned char chunk_length = (remaining_data >= SEND_CHUNK_MAX)
+                                       ? SEND_CHUNK_MAX
+                                       : (unsigned char)remaining_data;
+      if (framed + chunk_length + 2 > CHUNKED_BUFFER_SIZE) {
+        break;
+      }
+      chunked_buffer[framed] = SEND_CHUNK_SIGNAL;
+      chunked_buffer[framed + 1] = chunk_length;
+      memcpy(chunked_buffer + framed + 2, data + offset, chunk_length);
+      framed += chunk_length + 2;
+      remaining_data -= chunk_length;
+      offset += chunk_length;
+    }
+
+    // Allow one second per 4 KiB, as each chunk used to get a full second.
+    unsigned int timeout = 1000 * (1 + (unsigned int)(framed / 0x1000));
+    if (!send_to_player(chunked_buffer, (int)framed, &transferred,
+                                timeout) ||
+        (size_t)transferred != framed) {
+      fprintf(stderr, "Error when sending chunked data to the player.\n");
       return 0;
     }
-    remaining_data -= chunk_length;
-    offset += chunk_length;
   }
 
   return 1;
 }
 
-int ique_send_piecemeal_data(unsigned char *data, size_t data_length) {
-  // data_length + space for tags every 3 bytes
-  size_t send_data_length =
-      (data_length) + (data_length / 3) + (data_length % 3 != 0);
-  unsigned char *send_data = calloc(send_data_length, sizeof(unsigned char));
-  if (send_data == NULL) {
-    fprintf(stderr, "calloc failed when sending data.\n");
-    return 0;
-  }
+int ique_send_piecemeal_buffer(unsigned char *data, size_t data_length,
+                               unsigned char *frame_buffer) {
+  usb_set_phase(USB_PHASE_DATA);
+  return send_piecemeal(data, data_length, frame_buffer);
+}
 
-  process_piecemeal_data(data, data_length, send_data);
+static int send_piecemeal(unsigned char *data, size_t data_length,
+                          unsigned char *frame_buffer) {
+  size_t send_data_length =
+      framing_encode_piecemeal(data, data_length, frame_buffer);
 
   int transferred = 0;
-  if (!usb_bulk_transfer_send(send_data, send_data_length, &transferred,
-                              1000)) {
+  if (!send_to_player(frame_buffer, (int)send_data_length, &transferred,
+                      1000)) {
     fprintf(stderr, "Error when sending piecemeal data to the player.\n");
-    free(send_data);
     return 0;
   }
-
-  free(send_data);
   return 1;
 }
 
-static void process_piecemeal_data(unsigned char *input, size_t input_length,
-                                   unsigned char *output) {
-  size_t remaining_data = input_length;
-  size_t output_offset = 0;
-  size_t input_offset = 0;
-  while (remaining_data) {
-    unsigned char bytes_in_section =
-        (remaining_data >= 3) ? 3 : (unsigned char)remaining_data;
-    output[output_offset] = 0x40 + bytes_in_section;
-    memcpy(output + output_offset + 1, input + input_offset, bytes_in_section);
-
-    output_offset += bytes_in_section + 1;
-    input_offset += bytes_in_section;
-    remaining_data -= bytes_in_section;
+int ique_send_piecemeal_data(unsigned char *data, size_t data_length) {
+  // Short data (e.g. time data) is framed on the stack
+  unsigned char frame[FRAMING_PIECEMEAL_LENGTH(0x40)];
+  if (data_length <= 0x40) {
+    return ique_send_piecemeal_buffer(data, data_length, frame);
+  }
+
+  unsigned char *send_data =
+      pool_acquire(FRAMING_PIECEMEAL_LENGTH(data_length));
+  if (send_data == NULL) {
+    fprintf(stderr, "Could not get a buffer when sending data.\n");
+    return 0;
   }
+  int r = ique_send_piecemeal_buffer(data, data_length, send_data);
+  pool_release(send_data);
+  return r;
 }
 
 int ique_send_command(uint32_t command, uint32_t argument) {
-  ique_wait_for_ready();
+  if (!ique_wait_for_ready()) {
+    return 0;
+  }
   uint32_t message[2] = {htonl(command), htonl(argument)};
-  return ique_send_piecemeal_data((unsigned char *)message, 8);
+  unsigned char frame[FRAMING_PIECEMEAL_LENGTH(sizeof(message))];
+  usb_set_phase(USB_PHASE_COMMAND);
+  return send_piecemeal((unsigned char *)message, sizeof(message), frame);
 }
 
 int ique_send_ack(void) {
   int transferred = 0;
   unsigned char ack = 0x44;
-  return usb_bulk_transfer_send(&ack, 1, &transferred, 1000);
+  usb_set_phase(USB_PHASE_ACK);
+  return send_to_player(&ack, 1, &transferred, 1000);
+}
+
+// Anything the host sends uses up the player's ready state.
+static int send_to_player(unsigned char *data, int length, int *transferred,
+                          unsigned int timeout) {
+  ready_credit = 0;
+  return usb_bulk_transfer_send(data, length, transferred, timeout);
 }
 
 /*
@@ -173,6 +222,7 @@ int ique_receive_reply(unsigned char *buffer, size_t recv_length) {
         stderr,
         "Amount of data in reply exceeds the size of the allocated buffer:\n");
     fprintf(stderr, "%zu vs %zu.\n\n", data_length, recv_length);
+    discard_input();
     return 0;
   }
 
@@ -180,98 +230,97 @@ int ique_receive_reply(unsigned char *buffer, size_t recv_length) {
 }
 
 static size_t ique_receive_data_length(void) {
-  unsigned char length_buffer[4] = {0};
-  int transferred = 0;
-  int r = 0;
+  usb_set_phase(USB_PHASE_LENGTH);
 
   while (1) {
-    transferred = 0;
-    r = usb_bulk_transfer_receive(length_buffer, 4, &transferred, 1000);
-    if (r == 0 || transferred != 4) {
-      return 0;
+    if (buffered_input() < 4) {
+      if (!fill_input(4, 1000)) {
+        return 0;
+      }
+      // A zero-length packet terminating the previous reply, or a partial
+      // header -- try again.
+      continue;
     }
-    if (memcmp(length_buffer, READY_SIGNAL, 4) == 0) {
-      // Received a ready signal instead -- try again.
+
+    unsigned char *header = in_buffer + in_start;
+    if (memcmp(header, READY_SIGNAL, 4) == 0) {
+      // Received a ready signal instead -- keep it and try again.
+      usb_stats_ready_event(USB_READY_STRAY);
+      ready_credit = 1;
+      in_start += 4;
       continue;
     }
-    if (length_buffer[0] != 0x1B) {
+    if (header[0] != 0x1B) {
       fprintf(stderr,
               "Unknown transfer unit type encountered when receiving reply "
               "length: %hhx\n",
-              length_buffer[0]);
+              header[0]);
+      discard_input();
       return 0;
     }
-    break;
+
+    header[0] = 0;
+    size_t length = uchars_to_uint32(header);
+    in_start += 4;
+    return length;
   }
+}
 
-  length_buffer[0] = 0;
-  return uchars_to_uint32(length_buffer);
+/*
+    The player always fills its transfer units, except for the last one, so
+    the exact amount of framed data is known from the length header.
+*/
+static size_t framed_length(size_t data_length) {
+  return ((data_length + 2) / 3) * 4;
 }
 
 static int ique_receive_data(unsigned char *buffer, size_t data_length) {
-  // data_length + space for tags every 3 bytes (+ a little extra in case the
-  // player is inefficient)
-  size_t recv_buffer_length = (data_length) + ((data_length / 3) + 16);
-  unsigned char *recv_buffer =
-      calloc(recv_buffer_length, sizeof(unsigned char));
-  if (recv_buffer == NULL) {
-    fprintf(stderr, "calloc failed when receiving data.\n");
+  size_t expected_length = framed_length(data_length);
+  if (expected_length > IN_BUFFER_SIZE) {
+    fprintf(stderr, "Reply of %zu bytes is too large to receive.\n",
+            data_length);
+    discard_input();
     return 0;
   }
 
-  size_t total_data_received = 0;
-  unsigned char packet[PACKET_SIZE] = {0};
-  int transferred = PACKET_SIZE;
-
-  // Read one packet at a time; end after we receive a packet that is not full.
-  // This models the way USB receives packets normally and ensures all data sent
-  // from the console is read -- even if its more or less than expected.
-  while (transferred == PACKET_SIZE) {
-    transferred = 0;
-    if (usb_bulk_transfer_receive(packet, PACKET_SIZE, &transferred, 1000) &&
-        (total_data_received + transferred) <= recv_buffer_length) {
-      memcpy(recv_buffer + total_data_received, packet, transferred);
-      total_data_received += transferred;
-    } else {
-      free(recv_buffer);
+  usb_set_phase(USB_PHASE_DATA);
+
+  // Usually the whole reply arrives with one request. The request ends at
+  // the first packet that is not full, or as soon as the last whole packet
+  // of the reply has arrived, so a reply that is an exact multiple of the
+  // packet size never waits for a trailing timeout.
+  while (buffered_input() < expected_length) {
+    size_t before = buffered_input();
+    if (!fill_input(expected_length, 1000) || buffered_input() == before) {
       fprintf(stderr, "Error receiving data!\n");
-      fprintf(stderr,
-              "Buffer size: %zu bytes, Data received so far: %zu bytes, Next "
-              "transfer size: %d\n",
-              recv_buffer_length, total_data_received, transferred);
+      fprintf(stderr, "Expected: %zu bytes, Data received: %zu bytes\n",
+              expected_length, buffered_input());
+      discard_input();
       return 0;
     }
   }
 
   ique_send_ack();
-  int r = parse_received_data(recv_buffer, total_data_received, buffer,
+  int r = parse_received_data(in_buffer + in_start, expected_length, buffer,
                               data_length);
-  free(recv_buffer);
+  in_start += expected_length;
   return r;
 }
 
-static int parse_received_data(unsigned char *in_buffer,
+static int parse_received_data(unsigned char *in_data,
                                size_t total_data_received,
                                unsigned char *out_buffer,
                                size_t expected_data_length) {
   size_t in_offset = 0;
   size_t copied_data = 0;
 
-  while (copied_data < expected_data_length &&
-         in_offset < total_data_received) {
-    unsigned char tu = in_buffer[in_offset];
-    if (tu == 0x1F || tu == 0x1E || tu == 0x1D) {
-      size_t tu_length = tu - 0x1C;
-      memcpy(out_buffer + copied_data, in_buffer + in_offset + 1, tu_length);
-      copied_data += tu_length;
-    } else {
-      fprintf(stderr,
-              "Unknown transfer unit type encountered when parsing received "
-              "data: %hhx\n",
-              tu);
-      return 0;
-    }
-    in_offset += 4;
+  if (!framing_decode(in_data, total_data_received, &in_offset, out_buffer,
+                      expected_data_length, &copied_data)) {
+    fprintf(stderr,
+            "Unknown transfer unit type encountered when parsing received "
+            "data: %hhx\n",
+            in_data[in_offset]);
+    return 0;
   }
 
   if (copied_data != expected_data_length) {
@@ -284,21 +333,97 @@ static int parse_received_data(unsigned char *in_buffer,
 }
 
 /*
-    Wait for the ready signal (15 00 00 00)
+    Buffered input
+    Everything received from the player passes through in_buffer. Each read
+    asks for whole packets covering what the current step still expects,
+    and whatever arrives beyond that stays buffered for the following
+    steps. When the player has already sent a reply header together with
+    its data, or a reply together with the next ready signal, one transfer
+    then serves several protocol steps.
 */
-void ique_wait_for_ready(void) {
-  while (!ique_is_ready())
-    ;
+void ique_reset_protocol(void) {
+  discard_input();
+  ready_credit = 0;
 }
 
-static int ique_is_ready(void) {
-  unsigned char buffer[4] = {0};
+static size_t buffered_input(void) { return in_end - in_start; }
+
+static void discard_input(void) {
+  in_start = 0;
+  in_end = 0;
+}
+
+// Makes one read, asking for at least enough to buffer `expected` bytes.
+static int fill_input(size_t expected, unsigned int timeout) {
+  size_t have = buffered_input();
+  if (have == 0) {
+    discard_input();
+  }
+  size_t packet_size = (size_t)usb_in_packet_size();
+  size_t wanted = (expected > have) ? expected - have : 0;
+  wanted = ((wanted + packet_size - 1) / packet_size) * packet_size;
+  if (wanted == 0) {
+    wanted = packet_size;
+  }
+
+  if (in_end + wanted > IN_BUFFER_SIZE) {
+    memmove(in_buffer, in_buffer + in_start, have);
+    in_start = 0;
+    in_end = have;
+    if (in_end + wanted > IN_BUFFER_SIZE) {
+      wanted = ((IN_BUFFER_SIZE - in_end) / packet_size) * packet_size;
+    }
+  }
 
   int transferred = 0;
-  if (!usb_bulk_transfer_receive(buffer, 4, &transferred, 1000) ||
-      (transferred < 4)) {
-    return 0;
+  int r = usb_bulk_transfer_receive(in_buffer + in_end, (int)wanted,
+                                    &transferred, timeout);
+  in_end += (size_t)transferred;
+  return r;
+}
+
+/*
+    Wait for the ready signal (15 00 00 00)
+    The player sends it once it is waiting for data from the host, and stays
+    in that state until the host sends something. A ready signal received
+    since the last send is therefore kept as a credit, and waits made before
+    the next send are answered from it instead of reading from the player
+    again.
+*/
+int ique_wait_for_ready(void) {
+  if (ready_credit) {
+    usb_stats_ready_event(USB_READY_CREDITED);
+    return 1;
+  }
+
+  usb_set_phase(USB_PHASE_READY);
+  unsigned int attempts;
+  for (attempts = 0; attempts < READY_WAIT_ATTEMPTS; ++attempts) {
+    if (ique_is_ready()) {
+      usb_stats_ready_event(USB_READY_READ);
+      ready_credit = 1;
+      return 1;
+    }
+    if (usb_connection_failed()) {
+      break;
+    }
+    usb_stats_ready_event(USB_READY_RETRY);
+  }
+
+  usb_stats_ready_event(USB_READY_FAILED);
+  fprintf(stderr, "The console did not signal that it is ready.\n");
+  return 0;
+}
+
+static int ique_is_ready(void) {
+  if (buffered_input() < 4) {
+    fill_input(4, 1000);
+    if (buffered_input() < 4) {
+      return 0;
+    }
   }
 
-  return memcmp(buffer, READY_SIGNAL, 4) == 0;
+  int ready = memcmp(in_buffer + in_start, READY_SIGNAL, 4) == 0;
+  in_start += 4;
+  return ready;
 }
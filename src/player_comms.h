@@ -20,15 +20,25 @@
 #ifndef AULON_PLAYER_COMMS_H
 #define AULON_PLAYER_COMMS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "framing.h"
+
 int ique_send_chunked_data(unsigned char * data, size_t data_length);
 int ique_send_piecemeal_data(unsigned char * data, size_t data_length);
+// Same as above, but frames the data into the caller's frame_buffer, which
+// must hold FRAMING_PIECEMEAL_LENGTH(data_length) bytes.
+int ique_send_piecemeal_buffer(unsigned char * data, size_t data_length,
+                               unsigned char * frame_buffer);
 int ique_send_command(uint32_t command, uint32_t argument);
 int ique_send_ack(void);
 
 int ique_receive_reply(unsigned char * buffer, size_t recv_length);
+// Forgets buffered input and the ready state of an earlier connection.
+void ique_reset_protocol(void);
 
-void ique_wait_for_ready(void);
+// Returns 1 once the player is ready for data, or 0 if it never signals.
+int ique_wait_for_ready(void);
 
 #endif
@@ -0,0 +1,148 @@
+/*
+    pool.c
+    fixed slabs for the working buffers of the player protocol
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "commands.h"
+#include "pool.h"
+
+#ifdef GUI_BUILD
+#include "gui_redirect.h"
+#endif
+
+/*
+    Slab sizes. Replies are decoded straight into the caller's buffers, so
+    the pool only hands out raw blocks and spares: for reading runs of
+    blocks (read_blocks), single blocks (X and Y), file data written to the
+    console, and the FS spare and cache check in fs.c.
+
+    Slab counts cover the most buffers held at once: two blocks while a
+    cached FS block is compared with the console's, or a block and a spare
+    while reading blocks with their spares.
+*/
+#define POOL_BLOCK_SIZE BLOCK_SIZE
+#define POOL_SPARE_SIZE SPARE_SIZE
+#define POOL_BLOCK_COUNT 2
+#define POOL_SPARE_COUNT 1
+#define POOL_SLAB_COUNT (POOL_BLOCK_COUNT + POOL_SPARE_COUNT)
+
+struct slab {
+  unsigned char *data;
+  size_t size;
+  int in_use;
+};
+
+// Ordered from smallest to largest, so the first fit is the best fit.
+static struct slab slabs[POOL_SLAB_COUNT];
+static unsigned char *pool_memory = NULL;
+static size_t acquire_count = 0;
+static size_t heap_allocation_count = 0;
+
+static void add_slabs(size_t *slab_index, size_t *offset, size_t size,
+                      size_t count);
+static struct slab *find_slab(const unsigned char *buffer);
+
+int pool_init(void) {
+  if (pool_memory != NULL) {
+    return 1;
+  }
+
+  pool_memory = malloc(POOL_BLOCK_SIZE * POOL_BLOCK_COUNT +
+                       POOL_SPARE_SIZE * POOL_SPARE_COUNT);
+  if (pool_memory == NULL) {
+    fprintf(stderr, "Could not allocate the transfer buffer pool!\n");
+    return 0;
+  }
+
+  size_t slab_index = 0;
+  size_t offset = 0;
+  add_slabs(&slab_index, &offset, POOL_SPARE_SIZE, POOL_SPARE_COUNT);
+  add_slabs(&slab_index, &offset, POOL_BLOCK_SIZE, POOL_BLOCK_COUNT);
+
+  acquire_count = 0;
+  heap_allocation_count = 0;
+  return 1;
+}
+
+static void add_slabs(size_t *slab_index, size_t *offset, size_t size,
+                      size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    slabs[*slab_index].data = pool_memory + *offset;
+    slabs[*slab_index].size = size;
+    slabs[*slab_index].in_use = 0;
+    *slab_index += 1;
+    *offset += size;
+  }
+}
+
+void pool_free(void) {
+  for (size_t i = 0; i < POOL_SLAB_COUNT; ++i) {
+    if (slabs[i].in_use) {
+      fprintf(stderr, "Freeing the buffer pool while a buffer is in use!\n");
+    }
+    slabs[i].data = NULL;
+    slabs[i].size = 0;
+    slabs[i].in_use = 0;
+  }
+
+  free(pool_memory);
+  pool_memory = NULL;
+}
+
+unsigned char *pool_acquire(size_t size) {
+  ++acquire_count;
+  for (size_t i = 0; i < POOL_SLAB_COUNT; ++i) {
+    if (!slabs[i].in_use && slabs[i].data != NULL && size <= slabs[i].size) {
+      slabs[i].in_use = 1;
+      return slabs[i].data;
+    }
+  }
+
+  ++heap_allocation_count;
+  return malloc(size);
+}
+
+void pool_release(unsigned char *buffer) {
+  if (buffer == NULL) {
+    return;
+  }
+
+  struct slab *slab = find_slab(buffer);
+  if (slab != NULL) {
+    slab->in_use = 0;
+  } else {
+    free(buffer);
+  }
+}
+
+static struct slab *find_slab(const unsigned char *buffer) {
+  for (size_t i = 0; i < POOL_SLAB_COUNT; ++i) {
+    if (slabs[i].data == buffer) {
+      return &slabs[i];
+    }
+  }
+  return NULL;
+}
+
+size_t pool_acquire_count(void) { return acquire_count; }
+
+size_t pool_heap_allocation_count(void) { return heap_allocation_count; }
@@ -0,0 +1,46 @@
+/*
+    pool.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_POOL_H
+#define AULON_POOL_H
+
+#include <stddef.h>
+
+/*
+    Working buffers for the player protocol, preallocated once per session.
+    A request is served from the smallest free slab that fits it:
+        spare - a spare area (SPARE_SIZE bytes)
+        block - a block (BLOCK_SIZE bytes)
+    Requests that no free slab can serve fall back to the heap, and are
+    counted so that loops which should not allocate can be checked.
+
+    pool_init returns 1 for success and 0 for failure.
+    pool_acquire returns NULL on failure. Buffers are not cleared.
+*/
+int pool_init(void);
+void pool_free(void);
+unsigned char * pool_acquire(size_t size);
+void pool_release(unsigned char * buffer);
+
+// Number of buffers handed out, and how many of those came from the heap,
+// since pool_init.
+size_t pool_acquire_count(void);
+size_t pool_heap_allocation_count(void);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+    retry.c
+    the retry and backoff policy of the block commands
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "retry.h"
+#include "timing.h"
+#include "usb_stats.h"
+
+static struct retry_policy policy = {
+    5,       // max_attempts
+    10,      // base_delay_ms
+    250,     // max_delay_ms
+    50,      // jitter_percent
+    0,       // session_budget
+    {1, 1, 1} // retry_class
+};
+static unsigned int session_retries = 0;
+
+static const enum usb_retry_event retry_events[RETRY_ERROR_CLASS_COUNT] = {
+    USB_RETRY_REJECTED, USB_RETRY_TRANSFER, USB_RETRY_CONNECTION};
+
+static unsigned int backoff_ms(unsigned int attempt);
+
+void retry_get_policy(struct retry_policy *out) { *out = policy; }
+
+int retry_set_policy(const struct retry_policy *new_policy) {
+  if (new_policy->max_attempts == 0 || new_policy->jitter_percent > 100 ||
+      new_policy->max_delay_ms < new_policy->base_delay_ms) {
+    return 0;
+  }
+  policy = *new_policy;
+  return 1;
+}
+
+void retry_reset_session(void) { session_retries = 0; }
+
+unsigned int retry_session_count(void) { return session_retries; }
+
+int retry_after_failure(unsigned int attempt, enum retry_error_class error) {
+  if ((int)error < 0 || error >= RETRY_ERROR_CLASS_COUNT ||
+      !policy.retry_class[error] || attempt >= policy.max_attempts) {
+    usb_stats_retry_event(USB_RETRY_GAVE_UP);
+    return 0;
+  }
+  if (policy.session_budget != 0 && session_retries >= policy.session_budget) {
+    usb_stats_retry_event(USB_RETRY_OVER_BUDGET);
+    return 0;
+  }
+
+  ++session_retries;
+  usb_stats_retry_event(retry_events[error]);
+  unsigned int delay = backoff_ms(attempt);
+  if (delay) {
+    usb_stats_retry_backoff(delay);
+    timing_sleep_ms(delay);
+  }
+  return 1;
+}
+
+static unsigned int backoff_ms(unsigned int attempt) {
+  uint64_t delay = policy.base_delay_ms;
+  for (unsigned int i = 1; i < attempt && delay < policy.max_delay_ms; ++i) {
+    delay *= 2;
+  }
+  if (delay > policy.max_delay_ms) {
+    delay = policy.max_delay_ms;
+  }
+
+  uint64_t jitter = delay * policy.jitter_percent / 100;
+  if (jitter) {
+    delay -= (uint64_t)rand() % (jitter + 1);
+  }
+  return (unsigned int)delay;
+}
@@ -0,0 +1,62 @@
+/*
+    retry.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_RETRY_H
+#define AULON_RETRY_H
+
+/*
+    When the block commands retry after a failed attempt. Each retry waits
+    for a backoff that starts at base_delay_ms and doubles with every
+    attempt, up to max_delay_ms; jitter shortens each wait by a random
+    amount of up to jitter_percent, so that retries do not fall into step
+    with a busy console. Each class of error can be retried or not, and
+    session_budget caps the retries of a whole connection (0 for no cap).
+*/
+enum retry_error_class {
+    RETRY_ERROR_REJECTED   = 0, // The console returned an error code
+    RETRY_ERROR_TRANSFER   = 1, // A transfer failed or timed out
+    RETRY_ERROR_CONNECTION = 2  // The connection failed and must be reset
+};
+#define RETRY_ERROR_CLASS_COUNT 3
+
+struct retry_policy {
+    unsigned int max_attempts; // Including the first attempt
+    unsigned int base_delay_ms;
+    unsigned int max_delay_ms;
+    unsigned int jitter_percent;
+    unsigned int session_budget;
+    int retry_class[RETRY_ERROR_CLASS_COUNT];
+};
+
+void retry_get_policy(struct retry_policy * policy);
+// Returns 0 (and keeps the current policy) if the policy is not valid.
+int retry_set_policy(const struct retry_policy * policy);
+// Starts the retry budget over; called when a connection is opened.
+void retry_reset_session(void);
+// Retries used so far in this session
+unsigned int retry_session_count(void);
+
+/*
+    Called after attempt number [attempt] (1 for the first) failed with the
+    given class of error. Returns 1, after waiting out the backoff, if the
+    command should be tried again, and 0 if it should give up.
+*/
+int retry_after_failure(unsigned int attempt, enum retry_error_class error);
+
+#endif
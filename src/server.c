@@ -30,9 +30,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "defs.h"
 #include "menu_func.h"
 #include "server.h"
 #include "usb.h"
+#include "usb_stats.h"
 
 #define BUFFER_SIZE 4096
 #define MAX_RESPONSE_SIZE 65536
@@ -151,6 +153,59 @@ static void handle_command(const char *request, char *response,
       json_response(response, max_response, 0, "Missing 'filename' field",
                     NULL);
     }
+#if defined(AULON_WRITING_ENABLED) && (AULON_WRITING_ENABLED == 1)
+  } else if (strcmp(cmd, "write_file") == 0) {
+    if (json_get_string(request, "filename", filename, sizeof(filename))) {
+      char input_line[280];
+      snprintf(input_line, sizeof(input_line), "4 %s", filename);
+      int result = AulonWriteFile(input_line);
+      json_response(response, max_response, result ? 1 : 0,
+                    result ? "File written" : "Failed to write file", NULL);
+    } else {
+      json_response(response, max_response, 0, "Missing 'filename' field",
+                    NULL);
+    }
+  } else if (strcmp(cmd, "delete_file") == 0) {
+    if (json_get_string(request, "filename", filename, sizeof(filename))) {
+      char input_line[280];
+      snprintf(input_line, sizeof(input_line), "R %s", filename);
+      int result = AulonDeleteFile(input_line);
+      json_response(response, max_response, result ? 1 : 0,
+                    result ? "File deleted" : "Failed to delete file", NULL);
+    } else {
+      json_response(response, max_response, 0, "Missing 'filename' field",
+                    NULL);
+    }
+  } else if (strcmp(cmd, "rename_file") == 0) {
+    char new_filename[256] = {0};
+    if (json_get_string(request, "filename", filename, sizeof(filename)) &&
+        json_get_string(request, "new_filename", new_filename,
+                        sizeof(new_filename))) {
+      char input_line[540];
+      snprintf(input_line, sizeof(input_line), "N %s %s", filename,
+               new_filename);
+      int result = AulonRenameFile(input_line);
+      json_response(response, max_response, result ? 1 : 0,
+                    result ? "File renamed" : "Failed to rename file", NULL);
+    } else {
+      json_response(response, max_response, 0,
+                    "Missing 'filename' or 'new_filename' field", NULL);
+    }
+  } else if (strcmp(cmd, "batch") == 0) {
+    // "begin" stages the file commands that follow until "commit" or "abort"
+    char action[16] = {0};
+    if (json_get_string(request, "action", action, sizeof(action))) {
+      char input_line[32];
+      snprintf(input_line, sizeof(input_line), "T %s",
+               strcmp(action, "begin") == 0 ? "" : action);
+      int result = FileBatch(input_line);
+      json_response(response, max_response, result ? 1 : 0,
+                    result ? "Batch updated" : "Failed to update batch", NULL);
+    } else {
+      json_response(response, max_response, 0, "Missing 'action' field",
+                    NULL);
+    }
+#endif
   } else if (strcmp(cmd, "set_led") == 0) {
     char value[16] = {0};
     if (json_get_string(request, "value", value, sizeof(value))) {
@@ -168,6 +223,15 @@ static void handle_command(const char *request, char *response,
     snprintf(data, sizeof(data), "{\"connected\":%s}",
              connected ? "true" : "false");
     json_response(response, max_response, 1, "Status retrieved", data);
+  } else if (strcmp(cmd, "usb_stats") == 0) {
+    static char data[MAX_RESPONSE_SIZE / 2];
+    if (usb_stats_json(data, sizeof(data))) {
+      json_response(response, max_response, 1, "USB statistics retrieved",
+                    data);
+    } else {
+      json_response(response, max_response, 0,
+                    "USB statistics do not fit in a response", NULL);
+    }
   } else {
     json_response(response, max_response, 0, "Unknown command", NULL);
   }
@@ -0,0 +1,147 @@
+/*
+    sparse.c
+    sparse NAND images that leave out free and bad blocks
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "commands.h"
+#include "io.h"
+#include "sparse.h"
+
+#ifdef GUI_BUILD
+#include "gui_redirect.h"
+#endif
+
+/*
+    File format (all numbers big-endian):
+        header: "AULS", version (u32), number of blocks (u32),
+                number of present blocks (u32)
+        map:    one sparse_block_state byte per block
+        blocks: each present block (0x4000 bytes) and its spare (0x10),
+                in ascending order
+*/
+#define SPARSE_VERSION 1
+#define SPARSE_HEADER_SIZE 16
+// Byte of the spare that marks a bad block when it is not 0xFF
+#define SPARE_BAD_BLOCK_BYTE 5
+
+static const unsigned char SPARSE_MAGIC[4] = {'A', 'U', 'L', 'S'};
+
+static int read_header(FILE *file, unsigned char *map);
+
+int sparse_write_header(FILE *file, const unsigned char *map) {
+  uint32_t present = 0;
+  for (uint32_t i = 0; i < NUM_BLOCKS; ++i) {
+    present += (map[i] == SPARSE_PRESENT);
+  }
+
+  unsigned char header[SPARSE_HEADER_SIZE];
+  memcpy(header, SPARSE_MAGIC, 4);
+  uint32_to_uchars(header + 4, SPARSE_VERSION);
+  uint32_to_uchars(header + 8, NUM_BLOCKS);
+  uint32_to_uchars(header + 12, present);
+  if (fwrite(header, 1, SPARSE_HEADER_SIZE, file) != SPARSE_HEADER_SIZE ||
+      fwrite(map, 1, NUM_BLOCKS, file) != NUM_BLOCKS) {
+    fprintf(stderr, "Error writing the sparse image header.\n");
+    return 0;
+  }
+  return 1;
+}
+
+int sparse_write_block(FILE *file, const unsigned char *block_data,
+                       const unsigned char *spare_data) {
+  if (fwrite(block_data, 1, BLOCK_SIZE, file) != BLOCK_SIZE ||
+      fwrite(spare_data, 1, SPARE_SIZE, file) != SPARE_SIZE) {
+    fprintf(stderr, "Error writing a block to the sparse image.\n");
+    return 0;
+  }
+  return 1;
+}
+
+int sparse_expand(const char *sparse_path, const char *nand_path,
+                  const char *spare_path) {
+  FILE *sparse_file = NULL;
+  FILE *nand_file = NULL;
+  FILE *spare_file = NULL;
+  static unsigned char map[NUM_BLOCKS];
+  static unsigned char block[BLOCK_SIZE];
+  unsigned char spare[SPARE_SIZE];
+  int success = 0;
+
+  if (!open_file(&sparse_file, sparse_path, "rb")) {
+    return 0;
+  }
+  if (!read_header(sparse_file, map)) {
+    fprintf(stderr, "%s is not a sparse NAND image.\n", sparse_path);
+  } else if (open_file(&nand_file, nand_path, "wb") &&
+             open_file(&spare_file, spare_path, "wb")) {
+    success = 1;
+    for (uint32_t i = 0; i < NUM_BLOCKS && success; ++i) {
+      if (map[i] == SPARSE_PRESENT) {
+        success = fread(block, 1, BLOCK_SIZE, sparse_file) == BLOCK_SIZE &&
+                  fread(spare, 1, SPARE_SIZE, sparse_file) == SPARE_SIZE;
+        if (!success) {
+          fprintf(stderr, "The sparse image ends early, at block 0x%04x.\n",
+                  i);
+        }
+      } else {
+        memset(block, 0xFF, BLOCK_SIZE);
+        memset(spare, 0xFF, SPARE_SIZE);
+        if (map[i] == SPARSE_BAD) {
+          spare[SPARE_BAD_BLOCK_BYTE] = 0x00;
+        }
+      }
+      success = success &&
+                fwrite(block, 1, BLOCK_SIZE, nand_file) == BLOCK_SIZE &&
+                fwrite(spare, 1, SPARE_SIZE, spare_file) == SPARE_SIZE;
+    }
+    if (!success) {
+      fprintf(stderr, "Could not expand the sparse image.\n");
+    }
+  }
+
+  fclose(sparse_file);
+  if (nand_file) {
+    fclose(nand_file);
+  }
+  if (spare_file) {
+    fclose(spare_file);
+  }
+  return success;
+}
+
+static int read_header(FILE *file, unsigned char *map) {
+  unsigned char header[SPARSE_HEADER_SIZE];
+  if (fread(header, 1, SPARSE_HEADER_SIZE, file) != SPARSE_HEADER_SIZE ||
+      memcmp(header, SPARSE_MAGIC, 4) != 0 ||
+      uchars_to_uint32(header + 4) != SPARSE_VERSION ||
+      uchars_to_uint32(header + 8) != NUM_BLOCKS ||
+      fread(map, 1, NUM_BLOCKS, file) != NUM_BLOCKS) {
+    return 0;
+  }
+  for (uint32_t i = 0; i < NUM_BLOCKS; ++i) {
+    if (map[i] > SPARSE_BAD) {
+      return 0;
+    }
+  }
+  return 1;
+}
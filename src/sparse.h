@@ -0,0 +1,51 @@
+/*
+    sparse.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_SPARSE_H
+#define AULON_SPARSE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+    Sparse NAND images hold only the blocks that were read; a map records
+    what every other block was skipped as. Expanding one gives a standard
+    nand.bin and spare.bin, with skipped blocks erased (all 0xFF) and
+    skipped bad blocks marked bad in their spare.
+
+    The header and map are written first, with sparse_write_header; the
+    present blocks must then be written in ascending order.
+    All functions return 1 for success and 0 for failure.
+*/
+#define SPARSE_FILENAME "nand.sparse"
+
+enum sparse_block_state {
+    SPARSE_PRESENT = 0,
+    SPARSE_FREE    = 1,
+    SPARSE_BAD     = 2
+};
+
+// map holds a sparse_block_state for each of the NUM_BLOCKS blocks.
+int sparse_write_header(FILE * file, const unsigned char * map);
+int sparse_write_block(FILE * file, const unsigned char * block_data,
+                       const unsigned char * spare_data);
+int sparse_expand(const char * sparse_path, const char * nand_path,
+                  const char * spare_path);
+
+#endif
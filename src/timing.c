@@ -0,0 +1,80 @@
+/*
+    timing.c
+    monotonic clock and sleeping
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "timing.h"
+
+#ifdef _WIN32
+uint64_t timing_now_ns(void) {
+  static LARGE_INTEGER frequency = {0};
+  LARGE_INTEGER counter;
+  if (frequency.QuadPart == 0) {
+    QueryPerformanceFrequency(&frequency);
+  }
+  QueryPerformanceCounter(&counter);
+
+  // Split the conversion so the multiplication cannot overflow.
+  uint64_t seconds = (uint64_t)(counter.QuadPart / frequency.QuadPart);
+  uint64_t remainder = (uint64_t)(counter.QuadPart % frequency.QuadPart);
+  return seconds * 1000000000u +
+         remainder * 1000000000u / (uint64_t)frequency.QuadPart;
+}
+
+uint64_t timing_wall_clock_ns(void) {
+  // FILETIME counts 100 ns intervals since 1601-01-01.
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  uint64_t intervals =
+      ((uint64_t)now.dwHighDateTime << 32) | (uint64_t)now.dwLowDateTime;
+  return (intervals - 116444736000000000u) * 100u;
+}
+
+void timing_sleep_ms(unsigned int milliseconds) { Sleep(milliseconds); }
+#else
+uint64_t timing_now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+uint64_t timing_wall_clock_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void timing_sleep_ms(unsigned int milliseconds) {
+  struct timespec duration;
+  duration.tv_sec = milliseconds / 1000;
+  duration.tv_nsec = (long)(milliseconds % 1000) * 1000000L;
+  nanosleep(&duration, NULL);
+}
+#endif
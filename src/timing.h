@@ -0,0 +1,31 @@
+/*
+    timing.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_TIMING_H
+#define AULON_TIMING_H
+
+#include <stdint.h>
+
+// Nanoseconds from a monotonic clock with an arbitrary starting point
+uint64_t timing_now_ns(void);
+// Nanoseconds since the Unix epoch
+uint64_t timing_wall_clock_ns(void);
+void timing_sleep_ms(unsigned int milliseconds);
+
+#endif
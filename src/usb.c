@@ -29,9 +29,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include "defs.h"
+#include "timing.h"
 #include "usb.h"
 #include "usb_log.h"
+#include "usb_stats.h"
 
 #ifdef GUI_BUILD
 #include "gui_redirect.h"
@@ -44,28 +45,60 @@
 static const uint16_t IQUE_VID =
     0x1527; // 0xBB3D for old test SAs that support USB
 static const uint16_t IQUE_PID = 0xBBDB;
+// Used when the endpoint descriptors cannot be read
 static const unsigned char IQUE_BULK_EP_OUT = 0x02;
 static const unsigned char IQUE_BULK_EP_IN = 0x82;
+#define DEFAULT_PACKET_SIZE 0x40
+
+// Large IN reads are split into several transfers of this size which are kept
+// in flight at the same time, so the host never waits a full round trip
+// between two parts of the same reply.
+#define ASYNC_TRANSFER_SIZE 0x1000
+#define ASYNC_TRANSFER_COUNT 4
 
 static struct libusb_device_handle *device_handle = NULL;
 static int cleanup_required = 0;
 static int kernel_detached = 0;
 static int interface_claimed = 0;
 static int usb_initialized = 0;
+static struct libusb_transfer *async_transfers[ASYNC_TRANSFER_COUNT] = {NULL};
+static int async_available = 0;
+static enum usb_phase current_phase = USB_PHASE_OTHER;
+static int device_bus = 0;
+static int device_address = 0;
+static unsigned char bulk_ep_out = 0x02;
+static unsigned char bulk_ep_in = 0x82;
+static int in_packet_size = DEFAULT_PACKET_SIZE;
+
+static int libusb_open_transport(void);
+static int libusb_close_transport(void);
+static int libusb_reset_transport(void);
+static int libusb_send(unsigned char *data, int length, int *actual_length,
+                       unsigned int timeout);
+static int libusb_receive(unsigned char *data, int length, int *actual_length,
+                          unsigned int timeout);
+
+static const struct usb_transport libusb_transport = {
+    "libusb", libusb_open_transport, libusb_close_transport,
+    libusb_reset_transport, libusb_send, libusb_receive};
+static const struct usb_transport *transport = &libusb_transport;
+static int connected = 0;
+static int connection_failed = 0;
 
 static void usb_cleanup_close(void) { usb_close_connection(); }
 
-static void usb_init(void) {
+static int usb_init(void) {
   if (libusb_init(NULL) < 0) {
-    fprintf(stderr, "libusb could not be initialized; exiting...\n");
-    exit(EXIT_FAILURE);
+    fprintf(stderr, "libusb could not be initialized.\n");
+    return 0;
   }
   usb_initialized = 1;
+  return 1;
 }
 
 static int usb_get_device_handle(uint16_t vendor_id, uint16_t product_id) {
   device_handle = libusb_open_device_with_vid_pid(NULL, vendor_id, product_id);
-  return usb_handle_exists();
+  return (device_handle != NULL);
 }
 
 static int usb_detach_kernel_driver(void) {
@@ -143,12 +176,69 @@ static int usb_claim_device_interface(void) {
   return 1;
 }
 
-static int usb_connect_to_device(void) {
-  if (!cleanup_required) {
-    cleanup_required = 1;
-    atexit(usb_cleanup_close);
+static void usb_free_async_transfers(void) {
+  unsigned int i;
+  for (i = 0; i < ASYNC_TRANSFER_COUNT; ++i) {
+    libusb_free_transfer(async_transfers[i]);
+    async_transfers[i] = NULL;
+  }
+  async_available = 0;
+}
+
+static void usb_alloc_async_transfers(void) {
+  unsigned int i;
+  for (i = 0; i < ASYNC_TRANSFER_COUNT; ++i) {
+    async_transfers[i] = libusb_alloc_transfer(0);
+    if (async_transfers[i] == NULL) {
+      // Not fatal; large reads simply fall back to synchronous transfers.
+      usb_free_async_transfers();
+      return;
+    }
+  }
+  async_available = 1;
+}
+
+/*
+    Reads the bulk endpoints of interface 0 from the active configuration.
+    Missing descriptors are not fatal; the defaults are kept.
+*/
+static void usb_read_endpoints(void) {
+  struct libusb_config_descriptor *config = NULL;
+  int r = libusb_get_active_config_descriptor(libusb_get_device(device_handle),
+                                              &config);
+  if (r < 0) {
+    fprintf(stderr, "libusb_get_active_config_descriptor error: %s\n",
+            libusb_error_name(r));
+    return;
   }
 
+  if (config->bNumInterfaces > 0 && config->interface[0].num_altsetting > 0) {
+    const struct libusb_interface_descriptor *interface =
+        &config->interface[0].altsetting[0];
+    for (int i = 0; i < interface->bNumEndpoints; ++i) {
+      const struct libusb_endpoint_descriptor *ep = &interface->endpoint[i];
+      if ((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) !=
+          LIBUSB_TRANSFER_TYPE_BULK) {
+        continue;
+      }
+      int direction = (ep->bEndpointAddress & LIBUSB_ENDPOINT_IN) ? 0 : 1;
+      int packet_size = ep->wMaxPacketSize & 0x7FF;
+      if (direction == 0) {
+        bulk_ep_in = ep->bEndpointAddress;
+        if (packet_size > 0) {
+          in_packet_size = packet_size;
+        }
+      } else {
+        bulk_ep_out = ep->bEndpointAddress;
+      }
+      usb_stats_set_endpoint(direction, ep->bEndpointAddress,
+                             (unsigned int)packet_size, ep->bInterval);
+    }
+  }
+  libusb_free_config_descriptor(config);
+}
+
+static int usb_connect_to_device(void) {
   if (!usb_get_device_handle(IQUE_VID, IQUE_PID)) {
     fprintf(stderr,
             "The device could not be opened. Make sure it is plugged in!\n");
@@ -164,24 +254,28 @@ static int usb_connect_to_device(void) {
     fprintf(stderr, "Error configuring device connection.\n");
     return 0;
   }
-#if defined(AULON_LOGGING_ENABLED) && (AULON_LOGGING_ENABLED == 1)
-  usb_log_start();
-#endif
+  usb_read_endpoints();
+  usb_alloc_async_transfers();
+  libusb_device *device = libusb_get_device(device_handle);
+  device_bus = libusb_get_bus_number(device);
+  device_address = libusb_get_device_address(device);
   return 1;
 }
 
-int usb_init_connection(void) {
-  usb_init();
-  return usb_connect_to_device();
+static int libusb_open_transport(void) {
+  return usb_init() && usb_connect_to_device();
 }
 
-int usb_close_connection(void) {
+// Failures are reported, but the rest of the cleanup still happens, so the
+// device can be opened again afterwards.
+static int libusb_close_transport(void) {
+  int success = 1;
   if (interface_claimed) {
     int r = libusb_release_interface(device_handle, 0);
     if (r < 0) {
       fprintf(stderr, "libusb_release_interface error: %s\n",
               libusb_error_name(r));
-      return 0;
+      success = 0;
     }
     interface_claimed = 0;
   }
@@ -190,10 +284,11 @@ int usb_close_connection(void) {
     if (r < 0) {
       fprintf(stderr, "libusb_attach_kernel_driver error: %s\n",
               libusb_error_name(r));
-      return 0;
+      success = 0;
     }
     kernel_detached = 0;
   }
+  usb_free_async_transfers();
   if (device_handle) {
     libusb_close(device_handle);
     device_handle = NULL;
@@ -202,18 +297,100 @@ int usb_close_connection(void) {
     libusb_exit(NULL);
     usb_initialized = 0;
   }
-#if defined(AULON_LOGGING_ENABLED) && (AULON_LOGGING_ENABLED == 1)
-  usb_log_stop();
-#endif
+  return success;
+}
+
+static int libusb_reset_transport(void) {
+  if (device_handle) {
+    int r = libusb_reset_device(device_handle);
+    if (r == 0) {
+      libusb_clear_halt(device_handle, bulk_ep_in);
+      libusb_clear_halt(device_handle, bulk_ep_out);
+      return 1;
+    }
+    fprintf(stderr, "libusb_reset_device error: %s\n", libusb_error_name(r));
+  }
+  // The device went away or was re-enumerated; open it again.
+  libusb_close_transport();
+  return libusb_open_transport();
+}
+
+/*
+    Connection
+    The transport can only be changed while disconnected. Transports other
+    than libusb have no bus or address, so their logs show 0 for both.
+*/
+void usb_set_transport(const struct usb_transport *new_transport) {
+  if (!connected) {
+    transport = new_transport ? new_transport : &libusb_transport;
+  }
+}
+
+int usb_init_connection(void) {
+  if (!cleanup_required) {
+    cleanup_required = 1;
+    atexit(usb_cleanup_close);
+  }
+
+  usb_stats_reset();
+  connection_failed = 0;
+  device_bus = 0;
+  device_address = 0;
+  bulk_ep_out = IQUE_BULK_EP_OUT;
+  bulk_ep_in = IQUE_BULK_EP_IN;
+  in_packet_size = DEFAULT_PACKET_SIZE;
+  if (!transport->open()) {
+    return 0;
+  }
+  connected = 1;
+  usb_log_start(device_bus, device_address);
+  return 1;
+}
+
+int usb_close_connection(void) {
+  int success = transport->close();
+  if (connected) {
+    connected = 0;
+    usb_log_stop();
+  }
+  connection_failed = 0;
+  return success;
+}
+
+int usb_handle_exists(void) { return connected; }
+
+int usb_connection_failed(void) { return connection_failed; }
+
+int usb_recover_connection(void) {
+  if (!connected) {
+    return 0;
+  }
+
+  printf("Resetting the connection to the console...\n");
+  int success = 0;
+  if (transport->reset) {
+    success = transport->reset();
+  } else {
+    transport->close();
+    success = transport->open();
+  }
+
+  if (!success) {
+    usb_close_connection();
+    return 0;
+  }
+  connection_failed = 0;
   return 1;
 }
 
-int usb_handle_exists(void) { return (device_handle != NULL); }
+int usb_in_packet_size(void) { return in_packet_size; }
+
+void usb_set_phase(enum usb_phase phase) { current_phase = phase; }
 
 static int handle_usb_error(int error_code, unsigned char endpoint, int length,
                             int *actual_length, unsigned int timeout) {
   int success = 0;
-  const char *direction = (endpoint == IQUE_BULK_EP_IN ? "RECEIVE" : "SEND");
+  const char *direction = (endpoint == bulk_ep_in ? "RECEIVE" : "SEND");
 
   switch (error_code) {
   case LIBUSB_ERROR_TIMEOUT:
@@ -221,21 +398,26 @@ static int handle_usb_error(int error_code, unsigned char endpoint, int length,
     // transferred.\n", *actual_length);
     return (*actual_length != 0);
   case LIBUSB_ERROR_PIPE:
-    libusb_clear_halt(device_handle, endpoint);
+    if (device_handle) {
+      libusb_clear_halt(device_handle, endpoint);
+    }
     break;
   case LIBUSB_ERROR_INTERRUPTED:
     break;
-  default: // Unrecoverable error
+  default: // The connection needs to be reset
+    connection_failed = 1;
     fprintf(stderr, "\n%s - libusb_bulk_transfer FATAL error: %s\n%s\n\n",
             direction, libusb_error_name(error_code),
             libusb_strerror(error_code));
     fprintf(stderr, "If this error occurred while WRITING blocks or files to "
                     "the player,\nDO NOT POWER OFF OR RESET YOUR CONSOLE!\n");
-    fprintf(stderr, "Instead, simply attempt the write operation again.\n");
-    fprintf(stderr, "Alternatively, restart aulon, or use ique_diag.exe, in "
-                    "order to continue or restart the writing operation.\n");
-    exit(EXIT_FAILURE);
-    break;
+    fprintf(stderr, "If it occurred during a block read or write, aulon "
+                    "will reset the connection and retry\nthe block, as the "
+                    "retry policy (P) allows. Other commands are not retried "
+                    "and fail.\nIf a write cannot be completed, attempt it "
+                    "again, or use ique_diag.exe, in order to\ncontinue or "
+                    "restart the writing operation.\n");
+    return 0;
   }
 
   fprintf(stderr,
@@ -249,37 +431,167 @@ static int handle_usb_error(int error_code, unsigned char endpoint, int length,
 int usb_bulk_transfer_send(unsigned char *data, int length, int *actual_length,
                            unsigned int timeout) {
   int success = 1;
-  int r = libusb_bulk_transfer(device_handle, IQUE_BULK_EP_OUT, data, length,
-                               actual_length, timeout);
+  uint64_t start_ns = timing_now_ns();
+  int r = transport->send(data, length, actual_length, timeout);
+  uint64_t end_ns = timing_now_ns();
+  usb_stats_record(1, current_phase, r, *actual_length, start_ns, end_ns);
+  usb_log_transfer(data, length, *actual_length, 1, bulk_ep_out,
+                   current_phase, r < 0 ? r : 0, start_ns, end_ns);
   if (r < 0) {
     success =
-        handle_usb_error(r, IQUE_BULK_EP_OUT, length, actual_length, timeout);
-  }
-#if defined(AULON_LOGGING_ENABLED) && (AULON_LOGGING_ENABLED == 1)
-  if (success) {
-    usb_log_comms(data, *actual_length, 1);
-  } else {
-    usb_log_error(libusb_error_name(r));
+        handle_usb_error(r, bulk_ep_out, length, actual_length, timeout);
   }
-#endif
   return success;
 }
 
+static int libusb_send(unsigned char *data, int length, int *actual_length,
+                       unsigned int timeout) {
+  return libusb_bulk_transfer(device_handle, bulk_ep_out, data, length,
+                              actual_length, timeout);
+}
+
+/*
+    Asynchronous receive
+    Up to ASYNC_TRANSFER_COUNT transfers are submitted at once, each covering
+    the next ASYNC_TRANSFER_SIZE bytes of the destination buffer. Transfers on
+    an endpoint complete in the order they were submitted, so every completed
+    full transfer is followed directly by the next one and its slot can be
+    reused for the next part of the buffer.
+
+    Like a single bulk transfer, the read ends on the first short packet (or
+    when the buffer is full). Transfers still in flight at that point are
+    cancelled; the console does not send anything else before it gets the
+    host's acknowledgement, so they should never contain data.
+*/
+static void LIBUSB_CALL async_transfer_callback(struct libusb_transfer *t) {
+  *(int *)t->user_data = 1;
+}
+
+static int async_transfer_error(enum libusb_transfer_status status) {
+  switch (status) {
+  case LIBUSB_TRANSFER_COMPLETED:
+    return 0;
+  case LIBUSB_TRANSFER_TIMED_OUT:
+    return LIBUSB_ERROR_TIMEOUT;
+  case LIBUSB_TRANSFER_STALL:
+    return LIBUSB_ERROR_PIPE;
+  case LIBUSB_TRANSFER_NO_DEVICE:
+    return LIBUSB_ERROR_NO_DEVICE;
+  case LIBUSB_TRANSFER_OVERFLOW:
+    return LIBUSB_ERROR_OVERFLOW;
+  case LIBUSB_TRANSFER_CANCELLED:
+    return LIBUSB_ERROR_INTERRUPTED;
+  default:
+    return LIBUSB_ERROR_IO;
+  }
+}
+
+static int usb_receive_async(unsigned char *data, int length,
+                             int *actual_length, unsigned int timeout) {
+  int completed[ASYNC_TRANSFER_COUNT] = {0};
+  unsigned int head = 0;
+  unsigned int tail = 0;
+  unsigned int in_flight = 0;
+  int submit_offset = 0;
+  int finished = 0;
+  int error = 0;
+
+  *actual_length = 0;
+  while (in_flight < ASYNC_TRANSFER_COUNT && submit_offset < length) {
+    struct libusb_transfer *t = async_transfers[tail];
+    int t_length = length - submit_offset;
+    if (t_length > ASYNC_TRANSFER_SIZE) {
+      t_length = ASYNC_TRANSFER_SIZE;
+    }
+    completed[tail] = 0;
+    libusb_fill_bulk_transfer(t, device_handle, bulk_ep_in,
+                              data + submit_offset, t_length,
+                              async_transfer_callback, &completed[tail],
+                              timeout);
+    int r = libusb_submit_transfer(t);
+    if (r < 0) {
+      error = r;
+      finished = 1;
+      break;
+    }
+    submit_offset += t_length;
+    tail = (tail + 1) % ASYNC_TRANSFER_COUNT;
+    in_flight++;
+  }
+
+  while (in_flight) {
+    struct libusb_transfer *t = async_transfers[head];
+    // Each transfer is bounded by its own timeout, so this always ends.
+    while (!completed[head]) {
+      libusb_handle_events_completed(NULL, &completed[head]);
+    }
+    in_flight--;
+
+    if (finished) {
+      // Cancelled after the read already ended
+      if (t->actual_length > 0) {
+        fprintf(stderr, "RECEIVE - discarded %d bytes read past the end of "
+                        "a reply.\n",
+                t->actual_length);
+      }
+    } else {
+      *actual_length += t->actual_length;
+      error = async_transfer_error(t->status);
+      if (error || t->actual_length < t->length) {
+        finished = 1;
+      } else if (submit_offset < length) {
+        int t_length = length - submit_offset;
+        if (t_length > ASYNC_TRANSFER_SIZE) {
+          t_length = ASYNC_TRANSFER_SIZE;
+        }
+        completed[head] = 0;
+        t->buffer = data + submit_offset;
+        t->length = t_length;
+        int r = libusb_submit_transfer(t);
+        if (r < 0) {
+          error = r;
+          finished = 1;
+        } else {
+          submit_offset += t_length;
+          in_flight++;
+        }
+      }
+
+      if (finished) {
+        unsigned int i;
+        for (i = 1; i <= in_flight; ++i) {
+          libusb_cancel_transfer(
+              async_transfers[(head + i) % ASYNC_TRANSFER_COUNT]);
+        }
+      }
+    }
+    head = (head + 1) % ASYNC_TRANSFER_COUNT;
+  }
+
+  return error;
+}
+
 int usb_bulk_transfer_receive(unsigned char *data, int length,
                               int *actual_length, unsigned int timeout) {
   int success = 1;
-  int r = libusb_bulk_transfer(device_handle, IQUE_BULK_EP_IN, data, length,
-                               actual_length, timeout);
+  uint64_t start_ns = timing_now_ns();
+  int r = transport->receive(data, length, actual_length, timeout);
+  uint64_t end_ns = timing_now_ns();
+  usb_stats_record(0, current_phase, r, *actual_length, start_ns, end_ns);
+  usb_log_transfer(data, length, *actual_length, 0, bulk_ep_in,
+                   current_phase, r < 0 ? r : 0, start_ns, end_ns);
   if (r < 0) {
     success =
-        handle_usb_error(r, IQUE_BULK_EP_IN, length, actual_length, timeout);
+        handle_usb_error(r, bulk_ep_in, length, actual_length, timeout);
   }
-#if defined(AULON_LOGGING_ENABLED) && (AULON_LOGGING_ENABLED == 1)
-  if (success) {
-    usb_log_comms(data, *actual_length, 0);
-  } else {
-    usb_log_error(libusb_error_name(r));
-  }
-#endif
   return success;
 }
+
+static int libusb_receive(unsigned char *data, int length, int *actual_length,
+                          unsigned int timeout) {
+  if (async_available && length > ASYNC_TRANSFER_SIZE) {
+    return usb_receive_async(data, length, actual_length, timeout);
+  }
+  return libusb_bulk_transfer(device_handle, bulk_ep_in, data, length,
+                              actual_length, timeout);
+}
@@ -26,8 +26,61 @@
 int usb_init_connection(void);
 int usb_close_connection(void);
 int usb_handle_exists(void);
+
+/*
+    Errors other than timeouts, stalls and interruptions leave the
+    connection in an unknown state. The transfer fails, and
+    usb_connection_failed returns 1 until usb_recover_connection has reset
+    the device (or reopened it, if resetting is not enough). If recovery
+    fails, the connection is closed.
+*/
+int usb_connection_failed(void);
+int usb_recover_connection(void);
 int usb_bulk_transfer_send(unsigned char * data, int length, int * actual_length, unsigned int timeout);
 int usb_bulk_transfer_receive(unsigned char * data, int length, int * actual_length, unsigned int timeout);
 
+/*
+    Largest packet of the bulk IN endpoint, read from the device's endpoint
+    descriptors when connecting. Receive requests should be a multiple of
+    it. Defaults to 64 bytes (full speed) when it is not known.
+*/
+int usb_in_packet_size(void);
+
+/*
+    The part of the player protocol the next transfers belong to. Used to
+    tag transfers in logs and captures.
+*/
+enum usb_phase {
+    USB_PHASE_OTHER   = 0,
+    USB_PHASE_COMMAND = 1, // command and its arguments
+    USB_PHASE_READY   = 2, // waiting for the ready signal
+    USB_PHASE_LENGTH  = 3, // length header of a reply
+    USB_PHASE_DATA    = 4, // data sent to or received from the player
+    USB_PHASE_ACK     = 5  // acknowledgement of a reply
+};
+#define USB_PHASE_COUNT 6
+#define USB_PHASE_NAMES { "other", "command", "ready", "length", "data", "ack" }
+
+void usb_set_phase(enum usb_phase phase);
+
+/*
+    A transport carries the bulk transfers to and from the console. open,
+    close and reset return 1 for success and 0 for failure; send and
+    receive behave like libusb_bulk_transfer and return 0 or a LIBUSB_ERROR
+    code. reset may be NULL, in which case the transport is closed and
+    opened again. libusb is used unless another transport is selected
+    before connecting.
+*/
+struct usb_transport {
+    const char * name;
+    int (*open)(void);
+    int (*close)(void);
+    int (*reset)(void);
+    int (*send)(unsigned char * data, int length, int * actual_length, unsigned int timeout);
+    int (*receive)(unsigned char * data, int length, int * actual_length, unsigned int timeout);
+};
+
+void usb_set_transport(const struct usb_transport * transport);
+
 #endif
 
@@ -18,58 +18,547 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 #include "io.h"
+#include "timing.h"
+#include "usb.h"
 
 #ifdef GUI_BUILD
 #include "gui_redirect.h"
 #endif
+#include "usb_log.h"
 
-#ifdef GUI_BUILD
-#include "gui_redirect.h"
+/*
+    Records go through a single-producer, single-consumer ring: the thread
+    doing USB transfers only advances ring_head, the writer thread only
+    advances ring_tail. Both are free-running counters; the ring size is a
+    power of two, so (head - tail) is always the amount of data queued.
+*/
+#define RING_SIZE 0x400000
+#define RING_MASK (RING_SIZE - 1)
+
+#ifdef _MSC_VER
+#define LOAD_ACQUIRE(p) ((uint32_t)InterlockedCompareExchange((volatile LONG *)(p), 0, 0))
+#define STORE_RELEASE(p, v) InterlockedExchange((volatile LONG *)(p), (LONG)(v))
+#else
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
 #endif
-#include "usb_log.h"
+
+/*
+    pcapng: one section (header + interface description) per session, then
+    a submission and a completion packet per transfer, like usbmon produces.
+*/
+#define PCAP_LINKTYPE_USB_LINUX_MMAPPED 220
+#define PCAP_SNAPLEN 0x40000
+#define USBMON_HEADER_SIZE 64
+#define USB_TRANSFER_BULK 3
+#define URB_DIR_IN 0x200
 
 static int log_open = 0;
 static char *log_path = NULL;
+static char *pcap_path = NULL;
 static FILE *log_file = NULL;
+static FILE *pcap_file = NULL;
+
+static unsigned char *ring = NULL;
+static volatile uint32_t ring_head = 0;
+static volatile uint32_t ring_tail = 0;
+static volatile uint32_t stop_requested = 0;
+static unsigned long producer_stalls = 0;
+
+// Used only by the writer thread
+static uint64_t session_start_ns = 0;
+static uint64_t session_wall_clock_ns = 0;
+static int device_bus = 0;
+static int device_address = 0;
+static uint64_t urb_id = 0;
+static unsigned char *scratch = NULL;
+static size_t scratch_size = 0;
+
+#ifdef _WIN32
+static HANDLE writer_thread = NULL;
+#else
+static pthread_t writer_thread;
+#endif
+
+static int open_sinks(void);
+static void close_sinks(void);
+static int start_writer(void);
+static void join_writer(void);
+static void writer_loop(void);
+static int write_session_header(void);
+static int pcap_write_section(void);
+static void pcap_write_records(uint32_t tail, uint32_t head);
+static void pcap_write_packet(uint64_t timestamp_ns,
+                              const unsigned char *usbmon_header,
+                              const unsigned char *data, uint32_t length,
+                              const char *comment);
+static void usbmon_header(unsigned char *out, char type, int endpoint,
+                          uint64_t timestamp_ns, int32_t status,
+                          uint32_t urb_length, uint32_t captured);
+static int32_t libusb_status_to_errno(int32_t status);
+static void ring_copy_in(uint32_t position, const unsigned char *data,
+                         uint32_t length);
+static const unsigned char *ring_view(uint32_t position, uint32_t length);
+static void put_le16(unsigned char *out, uint16_t value);
+static void put_le32(unsigned char *out, uint32_t value);
+static void put_le64(unsigned char *out, uint64_t value);
+static uint32_t get_le32(const unsigned char *in);
+static uint64_t get_le64(const unsigned char *in);
 
 void usb_log_set_path(char *path) { log_path = path; }
 
-void usb_log_start(void) {
-  if (!log_path) {
-    // Log file path wasn't specified, so just exit.
+void usb_log_set_pcap_path(char *path) { pcap_path = path; }
+
+int usb_log_requested(void) { return (log_path != NULL || pcap_path != NULL); }
+
+void usb_log_start(int bus, int address) {
+  if (!usb_log_requested() || log_open) {
+    // No log file path was specified, so just exit.
     return;
   }
-  if (!open_file(&log_file, log_path, "a")) {
-    fprintf(stderr, "Log file could not be opened. Logging aborted.\n");
+
+  session_start_ns = timing_now_ns();
+  session_wall_clock_ns = timing_wall_clock_ns();
+  device_bus = bus;
+  device_address = address;
+  ring = malloc(RING_SIZE);
+  if (ring == NULL || !open_sinks()) {
+    fprintf(stderr, "Log could not be started. Logging aborted.\n");
+    free(ring);
+    ring = NULL;
+    return;
+  }
+
+  ring_head = 0;
+  ring_tail = 0;
+  stop_requested = 0;
+  producer_stalls = 0;
+  if (!start_writer()) {
+    fprintf(stderr, "Log writer could not be started. Logging aborted.\n");
+    close_sinks();
+    free(ring);
+    ring = NULL;
     return;
   }
-  fprintf(log_file, "\nLogging session started:\n");
   log_open = 1;
 }
 
 void usb_log_stop(void) {
   if (log_open) {
-    fprintf(log_file, "Logging session ended.\n");
-    fclose(log_file);
     log_open = 0;
+    STORE_RELEASE(&stop_requested, 1);
+    join_writer();
+    close_sinks();
+    free(ring);
+    ring = NULL;
+    free(scratch);
+    scratch = NULL;
+    scratch_size = 0;
+    if (producer_stalls) {
+      printf("USB log: waited for the log writer %lu times.\n",
+             producer_stalls);
+    }
   }
 }
 
-void usb_log_comms(unsigned char *buffer, unsigned int length, int direction) {
-  if (log_open) {
-    char *direction_label = (direction ? "SEND >>>" : "RECEIVE <<<");
-    fprintf(log_file, "%s %d bytes:\n", direction_label, length);
-    print_buffer(buffer, length, log_file);
-    fflush(log_file);
+static int open_sinks(void) {
+  if (log_path) {
+    if (!open_file(&log_file, log_path, "ab")) {
+      fprintf(stderr, "Log file could not be opened.\n");
+      return 0;
+    }
+    if (!write_session_header()) {
+      close_sinks();
+      return 0;
+    }
+  }
+  if (pcap_path) {
+    if (!open_file(&pcap_file, pcap_path, "ab")) {
+      fprintf(stderr, "Capture file could not be opened.\n");
+      close_sinks();
+      return 0;
+    }
+    if (!pcap_write_section()) {
+      close_sinks();
+      return 0;
+    }
   }
+  return 1;
 }
 
-void usb_log_error(const char *error) {
-  if (log_open) {
-    fprintf(log_file, "\nERROR - %s\n\n", error);
-    fflush(log_file);
+static void close_sinks(void) {
+  if (log_file) {
+    fclose(log_file);
+    log_file = NULL;
+  }
+  if (pcap_file) {
+    fclose(pcap_file);
+    pcap_file = NULL;
+  }
+}
+
+void usb_log_transfer(const unsigned char *buffer, int requested, int length,
+                      int direction, int endpoint, int phase, int status,
+                      uint64_t start_ns, uint64_t end_ns) {
+  if (!log_open) {
+    return;
+  }
+  if (length < 0) {
+    length = 0;
+  }
+
+  uint32_t record_size = USB_LOG_RECORD_SIZE + (uint32_t)length;
+  if (record_size > RING_SIZE) {
+    fprintf(stderr, "USB log: transfer of %d bytes is too large to record.\n",
+            length);
+    return;
+  }
+
+  // Wait for the writer if the ring is full; dropping records would make
+  // the trace useless.
+  uint32_t head = ring_head;
+  while (RING_SIZE - (head - LOAD_ACQUIRE(&ring_tail)) < record_size) {
+    ++producer_stalls;
+    timing_sleep_ms(1);
+  }
+
+  unsigned char record[USB_LOG_RECORD_SIZE] = {0};
+  put_le64(record, start_ns);
+  put_le64(record + 8, end_ns);
+  put_le32(record + 16, (uint32_t)length);
+  put_le32(record + 20, (uint32_t)status);
+  record[24] = (unsigned char)(direction ? 1 : 0);
+  record[25] = (unsigned char)phase;
+  record[26] = (unsigned char)endpoint;
+  put_le32(record + 28, (uint32_t)requested);
+
+  ring_copy_in(head, record, USB_LOG_RECORD_SIZE);
+  ring_copy_in(head + USB_LOG_RECORD_SIZE, buffer, (uint32_t)length);
+  STORE_RELEASE(&ring_head, head + record_size);
+}
+
+static void ring_copy_in(uint32_t position, const unsigned char *data,
+                         uint32_t length) {
+  uint32_t offset = position & RING_MASK;
+  uint32_t first = RING_SIZE - offset;
+  if (first >= length) {
+    memcpy(ring + offset, data, length);
+  } else {
+    memcpy(ring + offset, data, first);
+    memcpy(ring, data + first, length - first);
+  }
+}
+
+/*
+    Writer thread
+*/
+static void writer_loop(void) {
+  while (1) {
+    uint32_t tail = ring_tail;
+    uint32_t head = LOAD_ACQUIRE(&ring_head);
+    if (head == tail) {
+      if (LOAD_ACQUIRE(&stop_requested)) {
+        // The last record may have been queued after head was read.
+        if (LOAD_ACQUIRE(&ring_head) == tail) {
+          break;
+        }
+        continue;
+      }
+      timing_sleep_ms(1);
+      continue;
+    }
+
+    if (log_file) {
+      uint32_t offset = tail & RING_MASK;
+      uint32_t length = head - tail;
+      uint32_t first = RING_SIZE - offset;
+      if (first >= length) {
+        fwrite(ring + offset, 1, length, log_file);
+      } else {
+        fwrite(ring + offset, 1, first, log_file);
+        fwrite(ring, 1, length - first, log_file);
+      }
+      fflush(log_file);
+    }
+    if (pcap_file) {
+      pcap_write_records(tail, head);
+      fflush(pcap_file);
+    }
+    STORE_RELEASE(&ring_tail, head);
+  }
+}
+
+/*
+    Returns length bytes of the ring starting at position, copied into the
+    scratch buffer if they wrap around the end of the ring.
+*/
+static const unsigned char *ring_view(uint32_t position, uint32_t length) {
+  uint32_t offset = position & RING_MASK;
+  uint32_t first = RING_SIZE - offset;
+  if (first >= length) {
+    return ring + offset;
+  }
+
+  if (scratch_size < length) {
+    unsigned char *grown = realloc(scratch, length);
+    if (grown == NULL) {
+      return NULL;
+    }
+    scratch = grown;
+    scratch_size = length;
+  }
+  memcpy(scratch, ring + offset, first);
+  memcpy(scratch + first, ring, length - first);
+  return scratch;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI writer_thread_main(LPVOID parameter) {
+  (void)parameter;
+  writer_loop();
+  return 0;
+}
+
+static int start_writer(void) {
+  writer_thread = CreateThread(NULL, 0, writer_thread_main, NULL, 0, NULL);
+  return (writer_thread != NULL);
+}
+
+static void join_writer(void) {
+  WaitForSingleObject(writer_thread, INFINITE);
+  CloseHandle(writer_thread);
+  writer_thread = NULL;
+}
+#else
+static void *writer_thread_main(void *parameter) {
+  (void)parameter;
+  writer_loop();
+  return NULL;
+}
+
+static int start_writer(void) {
+  return (pthread_create(&writer_thread, NULL, writer_thread_main, NULL) == 0);
+}
+
+static void join_writer(void) { pthread_join(writer_thread, NULL); }
+#endif
+
+/*
+    Binary trace
+*/
+static int write_session_header(void) {
+  unsigned char header[USB_LOG_HEADER_SIZE] = {0};
+  memcpy(header, USB_LOG_MAGIC, 8);
+  put_le32(header + 8, USB_LOG_VERSION);
+  put_le64(header + 16, session_wall_clock_ns / 1000000000u);
+  put_le64(header + 24, session_start_ns);
+  return (fwrite(header, 1, USB_LOG_HEADER_SIZE, log_file) ==
+          USB_LOG_HEADER_SIZE);
+}
+
+/*
+    pcapng capture
+*/
+static int pcap_write_section(void) {
+  // Section header block: byte order magic, version 1.0, unknown length
+  unsigned char shb[28] = {0};
+  put_le32(shb, 0x0A0D0D0A);
+  put_le32(shb + 4, sizeof(shb));
+  put_le32(shb + 8, 0x1A2B3C4D);
+  put_le16(shb + 12, 1);
+  put_le16(shb + 14, 0);
+  put_le64(shb + 16, UINT64_MAX);
+  put_le32(shb + 24, sizeof(shb));
+
+  // Interface description block with nanosecond timestamps (if_tsresol 9)
+  unsigned char idb[32] = {0};
+  put_le32(idb, 1);
+  put_le32(idb + 4, sizeof(idb));
+  put_le16(idb + 8, PCAP_LINKTYPE_USB_LINUX_MMAPPED);
+  put_le32(idb + 12, PCAP_SNAPLEN);
+  put_le16(idb + 16, 9);
+  put_le16(idb + 18, 1);
+  idb[20] = 9;
+  put_le32(idb + 28, sizeof(idb));
+
+  return (fwrite(shb, 1, sizeof(shb), pcap_file) == sizeof(shb) &&
+          fwrite(idb, 1, sizeof(idb), pcap_file) == sizeof(idb));
+}
+
+static void pcap_write_records(uint32_t tail, uint32_t head) {
+  static const char *const phase_names[USB_PHASE_COUNT] = USB_PHASE_NAMES;
+  uint32_t position = tail;
+  while (position != head) {
+    unsigned char record[USB_LOG_RECORD_SIZE];
+    const unsigned char *view = ring_view(position, USB_LOG_RECORD_SIZE);
+    if (view == NULL) {
+      fprintf(stderr, "USB log: out of memory writing the capture.\n");
+      return;
+    }
+    memcpy(record, view, USB_LOG_RECORD_SIZE);
+    uint64_t start_ns = get_le64(record);
+    uint64_t end_ns = get_le64(record + 8);
+    uint32_t length = get_le32(record + 16);
+    int32_t status = (int32_t)get_le32(record + 20);
+    int direction = record[24];
+    unsigned int phase = record[25];
+    int endpoint = record[26];
+    uint32_t requested = get_le32(record + 28);
+
+    const unsigned char *data =
+        ring_view(position + USB_LOG_RECORD_SIZE, length);
+    if (data == NULL) {
+      // Out of memory: keep the packets, without their data.
+      length = 0;
+    }
+    const char *comment =
+        (phase < USB_PHASE_COUNT) ? phase_names[phase] : "unknown";
+    uint64_t submitted = session_wall_clock_ns + (start_ns - session_start_ns);
+    uint64_t completed = session_wall_clock_ns + (end_ns - session_start_ns);
+
+    // Data travels with the submission of an OUT transfer and the completion
+    // of an IN transfer.
+    unsigned char header[USBMON_HEADER_SIZE];
+    ++urb_id;
+    if (direction) {
+      usbmon_header(header, 'S', endpoint, submitted, -115, requested,
+                    length);
+      pcap_write_packet(submitted, header, data, length, comment);
+      usbmon_header(header, 'C', endpoint, completed,
+                    libusb_status_to_errno(status), length, 0);
+      pcap_write_packet(completed, header, NULL, 0, comment);
+    } else {
+      usbmon_header(header, 'S', endpoint, submitted, -115, requested, 0);
+      pcap_write_packet(submitted, header, NULL, 0, comment);
+      usbmon_header(header, 'C', endpoint, completed,
+                    libusb_status_to_errno(status), length, length);
+      pcap_write_packet(completed, header, data, length, comment);
+    }
+
+    position += USB_LOG_RECORD_SIZE + get_le32(record + 16);
+  }
+}
+
+// Enhanced packet block, with the protocol phase as the packet comment
+static void pcap_write_packet(uint64_t timestamp_ns,
+                              const unsigned char *usbmon_header,
+                              const unsigned char *data, uint32_t length,
+                              const char *comment) {
+  static const unsigned char padding[4] = {0};
+  uint32_t packet_length = USBMON_HEADER_SIZE + length;
+  uint32_t packet_padding = (4 - (packet_length & 3)) & 3;
+  uint32_t comment_length = (uint32_t)strlen(comment);
+  uint32_t comment_padding = (4 - (comment_length & 3)) & 3;
+  uint32_t total = 28 + packet_length + packet_padding + 4 + comment_length +
+                   comment_padding + 4 + 4;
+
+  unsigned char block[28];
+  put_le32(block, 6);
+  put_le32(block + 4, total);
+  put_le32(block + 8, 0);
+  put_le32(block + 12, (uint32_t)(timestamp_ns >> 32));
+  put_le32(block + 16, (uint32_t)timestamp_ns);
+  put_le32(block + 20, packet_length);
+  put_le32(block + 24, packet_length);
+  fwrite(block, 1, sizeof(block), pcap_file);
+  fwrite(usbmon_header, 1, USBMON_HEADER_SIZE, pcap_file);
+  if (length) {
+    fwrite(data, 1, length, pcap_file);
   }
+  fwrite(padding, 1, packet_padding, pcap_file);
+
+  unsigned char option[4];
+  put_le16(option, 1); // opt_comment
+  put_le16(option + 2, (uint16_t)comment_length);
+  fwrite(option, 1, sizeof(option), pcap_file);
+  fwrite(comment, 1, comment_length, pcap_file);
+  fwrite(padding, 1, comment_padding, pcap_file);
+  put_le32(option, 0); // opt_endofopt
+  fwrite(option, 1, sizeof(option), pcap_file);
+  put_le32(block, total);
+  fwrite(block, 1, 4, pcap_file);
+}
+
+// struct usbmon_packet (the 64-byte, mmapped variant)
+static void usbmon_header(unsigned char *out, char type, int endpoint,
+                          uint64_t timestamp_ns, int32_t status,
+                          uint32_t urb_length, uint32_t captured) {
+  memset(out, 0, USBMON_HEADER_SIZE);
+  put_le64(out, urb_id);
+  out[8] = (unsigned char)type;
+  out[9] = USB_TRANSFER_BULK;
+  out[10] = (unsigned char)endpoint;
+  out[11] = (unsigned char)device_address;
+  put_le16(out + 12, (uint16_t)device_bus);
+  out[14] = '-';                // no setup packet
+  out[15] = captured ? 0 : '<'; // data present or not
+  put_le64(out + 16, timestamp_ns / 1000000000u);
+  put_le32(out + 24, (uint32_t)((timestamp_ns % 1000000000u) / 1000u));
+  put_le32(out + 28, (uint32_t)status);
+  put_le32(out + 32, urb_length);
+  put_le32(out + 36, captured);
+  put_le32(out + 56, (endpoint & 0x80) ? URB_DIR_IN : 0);
+}
+
+// usbmon reports the URB status as a negative Linux errno.
+static int32_t libusb_status_to_errno(int32_t status) {
+  switch (status) {
+  case 0:
+    return 0;
+  case -1: // LIBUSB_ERROR_IO
+    return -5;
+  case -4: // LIBUSB_ERROR_NO_DEVICE
+    return -19;
+  case -7: // LIBUSB_ERROR_TIMEOUT
+    return -110;
+  case -8: // LIBUSB_ERROR_OVERFLOW
+    return -75;
+  case -9: // LIBUSB_ERROR_PIPE
+    return -32;
+  case -10: // LIBUSB_ERROR_INTERRUPTED
+    return -4;
+  default:
+    return -71;
+  }
+}
+
+/*
+    Encoding
+*/
+static void put_le16(unsigned char *out, uint16_t value) {
+  out[0] = (unsigned char)value;
+  out[1] = (unsigned char)(value >> 8);
+}
+
+static void put_le32(unsigned char *out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+
+static void put_le64(unsigned char *out, uint64_t value) {
+  for (int i = 0; i < 8; ++i) {
+    out[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+
+static uint32_t get_le32(const unsigned char *in) {
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) |
+         ((uint32_t)in[3] << 24);
+}
+
+static uint64_t get_le64(const unsigned char *in) {
+  return (uint64_t)get_le32(in) | ((uint64_t)get_le32(in + 4) << 32);
 }
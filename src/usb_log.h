@@ -21,10 +21,50 @@
 #ifndef AULON_USB_LOG_H
 #define AULON_USB_LOG_H
 
+#include <stdint.h>
+
+/*
+    Every bulk transfer can be recorded to two sinks:
+        -l <file>   a binary trace; tools/trace_convert turns it into the
+                    text format of earlier versions
+        -p <file>   a pcapng capture with the usbmon link type, for Wireshark
+    Recording a transfer only copies it into a ring buffer; a background
+    thread writes the ring to the sinks.
+
+    Every connection starts a new session in the file. All fields are
+    little endian.
+
+    Session header (32 bytes):
+        char     magic[8]       "AULONTRC"
+        uint32_t version        1
+        uint32_t reserved
+        int64_t  wall_clock     seconds since the Unix epoch ...
+        uint64_t start_ns       ... and the monotonic clock at that moment
+
+    Transfer record (32 bytes, followed by the payload):
+        uint64_t start_ns       monotonic clock when the transfer was started
+        uint64_t end_ns         and when it completed
+        uint32_t length         payload length (the amount transferred)
+        int32_t  status         0, or the libusb error code
+        uint8_t  direction      1 for SEND, 0 for RECEIVE
+        uint8_t  phase          protocol phase (enum usb_phase in usb.h)
+        uint8_t  endpoint       address of the endpoint used
+        uint8_t  reserved
+        uint32_t requested      length the transfer was started with
+*/
+#define USB_LOG_MAGIC "AULONTRC"
+#define USB_LOG_VERSION 1
+#define USB_LOG_HEADER_SIZE 32
+#define USB_LOG_RECORD_SIZE 32
+
 void usb_log_set_path(char * path);
-void usb_log_start(void);
+void usb_log_set_pcap_path(char * path);
+int usb_log_requested(void);
+// bus and address identify the device in pcap captures
+void usb_log_start(int bus, int address);
 void usb_log_stop(void);
-void usb_log_comms(unsigned char * buffer, unsigned int length, int direction);
-void usb_log_error(const char * error);
+void usb_log_transfer(const unsigned char * buffer, int requested, int length,
+                      int direction, int endpoint, int phase, int status,
+                      uint64_t start_ns, uint64_t end_ns);
 
 #endif
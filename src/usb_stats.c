@@ -0,0 +1,350 @@
+/*
+    usb_stats.c
+    latency histograms and counters for USB transfers
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "usb.h"
+#include "usb_stats.h"
+
+#ifdef GUI_BUILD
+#include "gui_redirect.h"
+#endif
+
+// libusb's LIBUSB_ERROR_TIMEOUT; kept here so this file needs no libusb
+#define STATUS_TIMEOUT (-7)
+
+struct transfer_stats {
+  uint64_t count;
+  uint64_t bytes;
+  uint64_t errors;
+  uint64_t timeouts;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[USB_STATS_BUCKETS];
+};
+
+struct endpoint_info {
+  unsigned int address;
+  unsigned int max_packet_size;
+  unsigned int interval;
+};
+
+// [direction][phase]; direction 0 is RECEIVE, 1 is SEND
+static struct transfer_stats stats[2][USB_PHASE_COUNT];
+static struct endpoint_info endpoints[2];
+static uint64_t ready_events[USB_READY_EVENT_COUNT];
+static uint64_t retry_events[USB_RETRY_EVENT_COUNT];
+static uint64_t retry_backoff_ms = 0;
+static uint64_t first_start_ns = 0;
+static uint64_t last_end_ns = 0;
+
+static const char *const direction_names[2] = {"receive", "send"};
+static const char *const phase_names[USB_PHASE_COUNT] = USB_PHASE_NAMES;
+static const char *const ready_event_names[USB_READY_EVENT_COUNT] = {
+    "read", "credited", "retries", "failed", "stray"};
+static const char *const retry_event_names[USB_RETRY_EVENT_COUNT] = {
+    "rejected", "transfer", "connection", "gave_up", "over_budget"};
+static const char *const retry_event_labels[USB_RETRY_EVENT_COUNT] = {
+    "after rejections", "after transfer errors", "after connection errors",
+    "given up", "over budget"};
+
+static unsigned int bucket_index(uint64_t elapsed_ns);
+static void sum_phases(int direction, struct transfer_stats *total);
+static void print_histogram(FILE *outstream, const struct transfer_stats *s);
+static int append(char *buffer, size_t buffer_length, size_t *used,
+                  const char *format, ...);
+static int append_stats(char *buffer, size_t buffer_length, size_t *used,
+                        const struct transfer_stats *s);
+
+void usb_stats_reset(void) {
+  memset(stats, 0, sizeof(stats));
+  memset(ready_events, 0, sizeof(ready_events));
+  memset(retry_events, 0, sizeof(retry_events));
+  retry_backoff_ms = 0;
+  memset(endpoints, 0, sizeof(endpoints));
+  first_start_ns = 0;
+  last_end_ns = 0;
+}
+
+void usb_stats_record(int direction, int phase, int status, int length,
+                      uint64_t start_ns, uint64_t end_ns) {
+  if (phase < 0 || phase >= USB_PHASE_COUNT) {
+    phase = USB_PHASE_OTHER;
+  }
+  struct transfer_stats *s = &stats[direction ? 1 : 0][phase];
+  uint64_t elapsed_ns = end_ns - start_ns;
+
+  s->count++;
+  s->bytes += (length > 0) ? (uint64_t)length : 0;
+  if (status == STATUS_TIMEOUT) {
+    s->timeouts++;
+  } else if (status < 0) {
+    s->errors++;
+  }
+  s->total_ns += elapsed_ns;
+  if (elapsed_ns > s->max_ns) {
+    s->max_ns = elapsed_ns;
+  }
+  s->buckets[bucket_index(elapsed_ns)]++;
+
+  if (first_start_ns == 0) {
+    first_start_ns = start_ns;
+  }
+  last_end_ns = end_ns;
+}
+
+void usb_stats_set_endpoint(int direction, unsigned int address,
+                            unsigned int max_packet_size,
+                            unsigned int interval) {
+  struct endpoint_info *e = &endpoints[direction ? 1 : 0];
+  e->address = address;
+  e->max_packet_size = max_packet_size;
+  e->interval = interval;
+}
+
+void usb_stats_ready_event(enum usb_ready_event event) {
+  if ((int)event >= 0 && event < USB_READY_EVENT_COUNT) {
+    ready_events[event]++;
+  }
+}
+
+void usb_stats_retry_event(enum usb_retry_event event) {
+  if ((int)event >= 0 && event < USB_RETRY_EVENT_COUNT) {
+    retry_events[event]++;
+  }
+}
+
+void usb_stats_retry_backoff(unsigned int milliseconds) {
+  retry_backoff_ms += milliseconds;
+}
+
+static unsigned int bucket_index(uint64_t elapsed_ns) {
+  uint64_t us = elapsed_ns / 1000;
+  unsigned int index = 0;
+  while (us && index < USB_STATS_BUCKETS - 1) {
+    us >>= 1;
+    ++index;
+  }
+  return index;
+}
+
+static void sum_phases(int direction, struct transfer_stats *total) {
+  memset(total, 0, sizeof(*total));
+  for (int p = 0; p < USB_PHASE_COUNT; ++p) {
+    const struct transfer_stats *s = &stats[direction][p];
+    total->count += s->count;
+    total->bytes += s->bytes;
+    total->errors += s->errors;
+    total->timeouts += s->timeouts;
+    total->total_ns += s->total_ns;
+    if (s->max_ns > total->max_ns) {
+      total->max_ns = s->max_ns;
+    }
+    for (int b = 0; b < USB_STATS_BUCKETS; ++b) {
+      total->buckets[b] += s->buckets[b];
+    }
+  }
+}
+
+/*
+    Text output
+*/
+void usb_stats_print(FILE *outstream) {
+  struct transfer_stats totals[2];
+  sum_phases(0, &totals[0]);
+  sum_phases(1, &totals[1]);
+
+  // Time spent inside transfers is the bus and the console; the rest of the
+  // elapsed time was spent on the host.
+  double elapsed = (last_end_ns - first_start_ns) / 1e9;
+  double busy = (totals[0].total_ns + totals[1].total_ns) / 1e9;
+  fprintf(outstream, "USB transfers: %.3f s elapsed, %.3f s in transfers, "
+                     "%.3f s on the host.\n",
+          elapsed, busy, elapsed > busy ? elapsed - busy : 0.0);
+
+  for (int d = 1; d >= 0; --d) {
+    const struct transfer_stats *t = &totals[d];
+    if (t->count == 0) {
+      continue;
+    }
+    fprintf(outstream,
+            "\n%s: %llu transfers, %llu bytes (%.2f MiB/s while "
+            "transferring), %llu errors, %llu timeouts\n",
+            d ? "SEND" : "RECEIVE", (unsigned long long)t->count,
+            (unsigned long long)t->bytes,
+            t->total_ns ? (t->bytes / 1048576.0) / (t->total_ns / 1e9) : 0.0,
+            (unsigned long long)t->errors, (unsigned long long)t->timeouts);
+    if (endpoints[d].address) {
+      fprintf(outstream,
+              "  endpoint 0x%02x: %u-byte packets, polling interval %u\n",
+              endpoints[d].address, endpoints[d].max_packet_size,
+              endpoints[d].interval);
+    }
+    fprintf(outstream, "  %-8s %10s %12s %8s %8s %10s %10s\n", "phase",
+            "count", "bytes", "errors", "timeouts", "mean us", "max us");
+    for (int p = 0; p < USB_PHASE_COUNT; ++p) {
+      const struct transfer_stats *s = &stats[d][p];
+      if (s->count == 0) {
+        continue;
+      }
+      fprintf(outstream, "  %-8s %10llu %12llu %8llu %8llu %10.1f %10.1f\n",
+              phase_names[p], (unsigned long long)s->count,
+              (unsigned long long)s->bytes, (unsigned long long)s->errors,
+              (unsigned long long)s->timeouts,
+              (s->total_ns / (double)s->count) / 1e3, s->max_ns / 1e3);
+    }
+    print_histogram(outstream, t);
+  }
+
+  fprintf(outstream, "\nREADY waits:");
+  for (int e = 0; e < USB_READY_EVENT_COUNT; ++e) {
+    fprintf(outstream, "%s %llu %s", e ? "," : "",
+            (unsigned long long)ready_events[e], ready_event_names[e]);
+  }
+  fprintf(outstream, "\n");
+
+  fprintf(outstream, "Block command retries:");
+  for (int e = 0; e < USB_RETRY_EVENT_COUNT; ++e) {
+    fprintf(outstream, "%s %llu %s", e ? "," : "",
+            (unsigned long long)retry_events[e], retry_event_labels[e]);
+  }
+  fprintf(outstream, "; %llu ms of backoff\n",
+          (unsigned long long)retry_backoff_ms);
+}
+
+static void print_histogram(FILE *outstream, const struct transfer_stats *s) {
+  static const char bar[] = "########################################";
+  uint64_t largest = 0;
+  for (int b = 0; b < USB_STATS_BUCKETS; ++b) {
+    if (s->buckets[b] > largest) {
+      largest = s->buckets[b];
+    }
+  }
+
+  fprintf(outstream, "  latency:\n");
+  for (int b = 0; b < USB_STATS_BUCKETS; ++b) {
+    if (s->buckets[b] == 0) {
+      continue;
+    }
+    unsigned long low = b ? 1ul << (b - 1) : 0;
+    int width = (int)((s->buckets[b] * (sizeof(bar) - 1) + largest - 1) /
+                      largest);
+    if (b == USB_STATS_BUCKETS - 1) {
+      fprintf(outstream, "    >= %8lu us %10llu %.*s\n", low,
+              (unsigned long long)s->buckets[b], width, bar);
+    } else {
+      fprintf(outstream, "    < %9lu us %10llu %.*s\n", 1ul << b,
+              (unsigned long long)s->buckets[b], width, bar);
+    }
+  }
+}
+
+/*
+    JSON output
+*/
+size_t usb_stats_json(char *buffer, size_t buffer_length) {
+  size_t used = 0;
+  int ok = append(buffer, buffer_length, &used,
+                  "{\"elapsed_ns\":%llu",
+                  (unsigned long long)(last_end_ns - first_start_ns));
+
+  for (int d = 1; d >= 0 && ok; --d) {
+    struct transfer_stats total;
+    sum_phases(d, &total);
+    ok = append(buffer, buffer_length, &used, ",\"%s\":", direction_names[d]) &&
+         append_stats(buffer, buffer_length, &used, &total) &&
+         append(buffer, buffer_length, &used,
+                ",\"endpoint\":{\"address\":%u,\"max_packet_size\":%u,"
+                "\"interval\":%u}",
+                endpoints[d].address, endpoints[d].max_packet_size,
+                endpoints[d].interval) &&
+         append(buffer, buffer_length, &used, ",\"phases\":{");
+    int first = 1;
+    for (int p = 0; p < USB_PHASE_COUNT && ok; ++p) {
+      if (stats[d][p].count == 0) {
+        continue;
+      }
+      ok = append(buffer, buffer_length, &used, "%s\"%s\":",
+                  first ? "" : ",", phase_names[p]) &&
+           append_stats(buffer, buffer_length, &used, &stats[d][p]) &&
+           append(buffer, buffer_length, &used, "}");
+      first = 0;
+    }
+    ok = ok && append(buffer, buffer_length, &used, "}}");
+  }
+
+  ok = ok && append(buffer, buffer_length, &used, ",\"ready\":{");
+  for (int e = 0; e < USB_READY_EVENT_COUNT && ok; ++e) {
+    ok = append(buffer, buffer_length, &used, "%s\"%s\":%llu", e ? "," : "",
+                ready_event_names[e], (unsigned long long)ready_events[e]);
+  }
+  ok = ok && append(buffer, buffer_length, &used, "},\"retries\":{");
+  for (int e = 0; e < USB_RETRY_EVENT_COUNT && ok; ++e) {
+    ok = append(buffer, buffer_length, &used, "%s\"%s\":%llu", e ? "," : "",
+                retry_event_names[e], (unsigned long long)retry_events[e]);
+  }
+  ok = ok && append(buffer, buffer_length, &used, ",\"backoff_ms\":%llu}}",
+                    (unsigned long long)retry_backoff_ms);
+  return ok ? used : 0;
+}
+
+// Leaves the object open, so callers can add to it.
+static int append_stats(char *buffer, size_t buffer_length, size_t *used,
+                        const struct transfer_stats *s) {
+  int ok = append(buffer, buffer_length, used,
+                  "{\"count\":%llu,\"bytes\":%llu,\"errors\":%llu,"
+                  "\"timeouts\":%llu,\"total_ns\":%llu,\"max_ns\":%llu,"
+                  "\"histogram_us\":[",
+                  (unsigned long long)s->count, (unsigned long long)s->bytes,
+                  (unsigned long long)s->errors,
+                  (unsigned long long)s->timeouts,
+                  (unsigned long long)s->total_ns,
+                  (unsigned long long)s->max_ns);
+
+  // Trailing empty buckets are left out.
+  int last = USB_STATS_BUCKETS - 1;
+  while (last >= 0 && s->buckets[last] == 0) {
+    --last;
+  }
+  for (int b = 0; b <= last && ok; ++b) {
+    ok = append(buffer, buffer_length, used, "%s%llu", b ? "," : "",
+                (unsigned long long)s->buckets[b]);
+  }
+  return ok && append(buffer, buffer_length, used, "]");
+}
+
+static int append(char *buffer, size_t buffer_length, size_t *used,
+                  const char *format, ...) {
+  if (*used >= buffer_length) {
+    return 0;
+  }
+  va_list args;
+  va_start(args, format);
+  int r = vsnprintf(buffer + *used, buffer_length - *used, format, args);
+  va_end(args);
+  if (r < 0 || (size_t)r >= buffer_length - *used) {
+    return 0;
+  }
+  *used += (size_t)r;
+  return 1;
+}
@@ -0,0 +1,88 @@
+/*
+    usb_stats.h
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AULON_USB_STATS_H
+#define AULON_USB_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+    Counters and latency histograms for every bulk transfer, kept per
+    direction and per protocol phase (enum usb_phase in usb.h). They are
+    reset each time a connection is opened.
+
+    Latencies are bucketed by powers of two in microseconds: bucket 0 holds
+    transfers under 1 us, bucket n holds those of [2^(n-1), 2^n) us, and the
+    last bucket holds everything longer.
+*/
+#define USB_STATS_BUCKETS 32
+
+void usb_stats_reset(void);
+void usb_stats_record(int direction, int phase, int status, int length,
+                      uint64_t start_ns, uint64_t end_ns);
+
+/*
+    Waits for the player's ready signal (see ique_wait_for_ready). A wait
+    is either answered from a ready signal already received (credited) or
+    by reading one; reads that return something else are retries, and a
+    wait that runs out of retries has failed. Stray ready signals are the
+    ones received while a reply was expected.
+*/
+enum usb_ready_event {
+    USB_READY_READ     = 0,
+    USB_READY_CREDITED = 1,
+    USB_READY_RETRY    = 2,
+    USB_READY_FAILED   = 3,
+    USB_READY_STRAY    = 4
+};
+#define USB_READY_EVENT_COUNT 5
+
+void usb_stats_ready_event(enum usb_ready_event event);
+
+/*
+    Retries of the block commands (see retry.h), counted by the class of
+    error that caused them, and the attempts that were given up because
+    the policy allows no more retries or the session's retry budget is
+    spent. The time spent in backoff is added up as well.
+*/
+enum usb_retry_event {
+    USB_RETRY_REJECTED    = 0,
+    USB_RETRY_TRANSFER    = 1,
+    USB_RETRY_CONNECTION  = 2,
+    USB_RETRY_GAVE_UP     = 3,
+    USB_RETRY_OVER_BUDGET = 4
+};
+#define USB_RETRY_EVENT_COUNT 5
+
+void usb_stats_retry_event(enum usb_retry_event event);
+void usb_stats_retry_backoff(unsigned int milliseconds);
+
+// Descriptor values of the bulk endpoint used for a direction (0 for
+// receive, 1 for send), shown with the statistics.
+void usb_stats_set_endpoint(int direction, unsigned int address,
+                            unsigned int max_packet_size, unsigned int interval);
+
+void usb_stats_print(FILE * outstream);
+// Writes the statistics as a JSON object; returns the length written, or 0
+// if they did not fit.
+size_t usb_stats_json(char * buffer, size_t buffer_length);
+
+#endif
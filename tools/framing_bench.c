@@ -0,0 +1,106 @@
+/*
+    framing_bench.c
+    microbenchmark for the transfer unit decoder in src/framing.c
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Usage: framing_bench [megabytes]
+
+    Frames random data the way the player sends a block chunk (0x1000 bytes
+    in 0x1F units, the last one shorter), then decodes it repeatedly with each
+    kernel the CPU supports. Every kernel's output is checked against the
+    original data.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "framing.h"
+
+#define CHUNK_SIZE 0x1000
+#define FRAMED_SIZE (((CHUNK_SIZE + 2) / 3) * 4)
+
+static void frame_chunk(const unsigned char *data, unsigned char *framed) {
+  size_t in = 0;
+  size_t out = 0;
+  while (in < CHUNK_SIZE) {
+    size_t n = (CHUNK_SIZE - in >= 3) ? 3 : CHUNK_SIZE - in;
+    memset(framed + out, 0, 4);
+    framed[out] = (unsigned char)(0x1C + n);
+    memcpy(framed + out + 1, data + in, n);
+    in += n;
+    out += 4;
+  }
+}
+
+static int run_kernel(enum framing_kernel kernel, const unsigned char *framed,
+                      const unsigned char *expected, unsigned long iterations) {
+  unsigned char out[CHUNK_SIZE];
+  if (!framing_use_kernel(kernel)) {
+    printf("%-8s not supported by this CPU\n", framing_kernel_name(kernel));
+    return 1;
+  }
+
+  clock_t start = clock();
+  unsigned long i;
+  for (i = 0; i < iterations; ++i) {
+    size_t in_offset = 0;
+    size_t out_offset = 0;
+    if (!framing_decode(framed, FRAMED_SIZE, &in_offset, out, CHUNK_SIZE,
+                        &out_offset) ||
+        out_offset != CHUNK_SIZE) {
+      fprintf(stderr, "%s: decoding failed\n", framing_kernel_name(kernel));
+      return 0;
+    }
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  if (memcmp(out, expected, CHUNK_SIZE) != 0) {
+    fprintf(stderr, "%s: decoded data does not match\n",
+            framing_kernel_name(kernel));
+    return 0;
+  }
+
+  double megabytes = (double)iterations * CHUNK_SIZE / (1024.0 * 1024.0);
+  printf("%-8s %8.1f MiB/s (%.0f MiB in %.3f s)\n",
+         framing_kernel_name(kernel),
+         seconds > 0 ? megabytes / seconds : 0.0, megabytes, seconds);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long megabytes = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1024;
+  unsigned long iterations = megabytes * (1024 * 1024 / CHUNK_SIZE);
+  if (iterations == 0) {
+    iterations = 1;
+  }
+
+  unsigned char data[CHUNK_SIZE];
+  unsigned char framed[FRAMED_SIZE];
+  unsigned int i;
+  srand((unsigned int)time(NULL));
+  for (i = 0; i < CHUNK_SIZE; ++i) {
+    data[i] = (unsigned char)rand();
+  }
+  frame_chunk(data, framed);
+
+  int success = run_kernel(FRAMING_SCALAR, framed, data, iterations) &&
+                run_kernel(FRAMING_SSSE3, framed, data, iterations) &&
+                run_kernel(FRAMING_AVX2, framed, data, iterations);
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,224 @@
+/*
+    trace_convert.c
+    converts a binary USB trace (aulon -l) to text
+
+    Copyright (c) 2026
+    This file is a part of aulon.
+
+    aulon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    aulon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Usage: trace_convert [-t] trace_file [text_file]
+
+    Writes the same text the logger used to write directly: one entry per
+    transfer with its direction, length and a hex dump of the data, and an
+    ERROR line for each failed transfer. With -t, each entry is prefixed
+    with the time since the start of its session, the transfer's duration
+    and the protocol phase it belongs to.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "io.h"
+#include "usb.h"
+#include "usb_log.h"
+
+static int convert_trace(FILE *in, FILE *out, int timestamps);
+static const char *error_name(int32_t status);
+static uint32_t get_le32(const unsigned char *in);
+static uint64_t get_le64(const unsigned char *in);
+
+int main(int argc, char *argv[]) {
+  int timestamps = 0;
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "-t") == 0) {
+    timestamps = 1;
+    ++arg;
+  }
+  if (arg >= argc) {
+    fprintf(stderr, "Usage: %s [-t] trace_file [text_file]\n", argv[0]);
+    return 1;
+  }
+
+  FILE *in = fopen(argv[arg], "rb");
+  if (in == NULL) {
+    perror("Error opening trace file");
+    return 1;
+  }
+  FILE *out = stdout;
+  if (arg + 1 < argc) {
+    out = fopen(argv[arg + 1], "w");
+    if (out == NULL) {
+      perror("Error opening text file");
+      fclose(in);
+      return 1;
+    }
+  }
+
+  int r = convert_trace(in, out, timestamps);
+
+  fclose(in);
+  if (out != stdout) {
+    fclose(out);
+  }
+  return r ? 0 : 1;
+}
+
+/*
+    Converts every session in the file. Returns 1 if the whole file was
+    converted, 0 if it is malformed or truncated.
+*/
+static int convert_trace(FILE *in, FILE *out, int timestamps) {
+  static const char *const phase_names[USB_PHASE_COUNT] = USB_PHASE_NAMES;
+  unsigned char header[USB_LOG_HEADER_SIZE];
+  unsigned char *payload = NULL;
+  size_t payload_capacity = 0;
+  int in_session = 0;
+  uint64_t session_start = 0;
+  int success = 1;
+
+  while (1) {
+    // Records and session headers are the same size; the magic tells them
+    // apart.
+    size_t read = fread(header, 1, USB_LOG_HEADER_SIZE, in);
+    if (read == 0) {
+      break;
+    }
+    if (read != USB_LOG_HEADER_SIZE) {
+      fprintf(stderr, "Trace file is truncated.\n");
+      success = 0;
+      break;
+    }
+
+    if (memcmp(header, USB_LOG_MAGIC, 8) == 0) {
+      if (get_le32(header + 8) != USB_LOG_VERSION) {
+        fprintf(stderr, "Unsupported trace version %u.\n",
+                get_le32(header + 8));
+        success = 0;
+        break;
+      }
+      if (in_session) {
+        fprintf(out, "Logging session ended.\n");
+      }
+      time_t wall_clock = (time_t)(int64_t)get_le64(header + 16);
+      char started[32] = {0};
+      struct tm *t = gmtime(&wall_clock);
+      if (timestamps && t != NULL &&
+          strftime(started, sizeof(started), " %Y-%m-%d %H:%M:%S UTC", t)) {
+        fprintf(out, "\nLogging session started:%s\n", started);
+      } else {
+        fprintf(out, "\nLogging session started:\n");
+      }
+      session_start = get_le64(header + 24);
+      in_session = 1;
+      continue;
+    }
+    if (!in_session) {
+      fprintf(stderr, "Not an aulon trace file.\n");
+      success = 0;
+      break;
+    }
+
+    uint64_t start_ns = get_le64(header);
+    uint64_t end_ns = get_le64(header + 8);
+    uint32_t length = get_le32(header + 16);
+    int32_t status = (int32_t)get_le32(header + 20);
+    int direction = header[24];
+    unsigned int phase = header[25];
+
+    if (length > payload_capacity) {
+      unsigned char *grown = realloc(payload, length);
+      if (grown == NULL) {
+        fprintf(stderr, "Could not allocate memory for a %u byte record.\n",
+                length);
+        success = 0;
+        break;
+      }
+      payload = grown;
+      payload_capacity = length;
+    }
+    if (fread(payload, 1, length, in) != length) {
+      fprintf(stderr, "Trace file is truncated.\n");
+      success = 0;
+      break;
+    }
+
+    if (timestamps) {
+      fprintf(out, "[%.6f +%.3f ms %s] ", (start_ns - session_start) / 1e9,
+              (end_ns - start_ns) / 1e6,
+              phase < USB_PHASE_COUNT ? phase_names[phase] : "unknown");
+    }
+    if (status == 0) {
+      fprintf(out, "%s %u bytes:\n", direction ? "SEND >>>" : "RECEIVE <<<",
+              length);
+      print_buffer(payload, length, out);
+    } else {
+      if (length) {
+        fprintf(out, "%s %u bytes:\n",
+                direction ? "SEND >>>" : "RECEIVE <<<", length);
+        print_buffer(payload, length, out);
+      }
+      fprintf(out, "\nERROR - %s\n\n", error_name(status));
+    }
+  }
+
+  if (in_session && success) {
+    fprintf(out, "Logging session ended.\n");
+  }
+  free(payload);
+  return success;
+}
+
+// Names of the libusb error codes, as returned by libusb_error_name
+static const char *error_name(int32_t status) {
+  switch (status) {
+  case -1:
+    return "LIBUSB_ERROR_IO";
+  case -2:
+    return "LIBUSB_ERROR_INVALID_PARAM";
+  case -3:
+    return "LIBUSB_ERROR_ACCESS";
+  case -4:
+    return "LIBUSB_ERROR_NO_DEVICE";
+  case -5:
+    return "LIBUSB_ERROR_NOT_FOUND";
+  case -6:
+    return "LIBUSB_ERROR_BUSY";
+  case -7:
+    return "LIBUSB_ERROR_TIMEOUT";
+  case -8:
+    return "LIBUSB_ERROR_OVERFLOW";
+  case -9:
+    return "LIBUSB_ERROR_PIPE";
+  case -10:
+    return "LIBUSB_ERROR_INTERRUPTED";
+  case -11:
+    return "LIBUSB_ERROR_NO_MEM";
+  case -12:
+    return "LIBUSB_ERROR_NOT_SUPPORTED";
+  default:
+    return "LIBUSB_ERROR_OTHER";
+  }
+}
+
+static uint32_t get_le32(const unsigned char *in) {
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) |
+         ((uint32_t)in[3] << 24);
+}
+
+static uint64_t get_le64(const unsigned char *in) {
+  return (uint64_t)get_le32(in) | ((uint64_t)get_le32(in + 4) << 32);
+}